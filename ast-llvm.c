@@ -0,0 +1,172 @@
+/*
+ * LLVM back end for the AST.  This follows the same recipe as the codegen
+ * helpers in llvm/: every variable gets an alloca in the entry block, an
+ * assignment is a store and a variable reference is a load.  Values are ints,
+ * just like in the C++ translation.
+ */
+
+#include <llvm-c/Core.h>
+#include <llvm-c/Analysis.h>
+#include "ast.h"
+
+static const char* operation_name(uint8_t op) {
+    switch (op) {
+    case AST_ADD: return "sum";
+    case AST_SUB: return "difference";
+    case AST_MUL: return "product";
+    default: return "quotient";
+    }
+}
+
+struct llvm_emitter {
+    const ast& tree;
+    LLVMContextRef context;
+    LLVMBuilderRef builder;
+    LLVMTypeRef int_type;
+    LLVMValueRef divided_by_zero;          // Whether any division so far was by 0
+    std::vector<LLVMValueRef> variables;   // alloca for each symbol ID
+    std::vector<LLVMValueRef> values;      // Value already built for each node
+    std::vector<int32_t> pending;          // Nodes waiting for their operands
+};
+
+/*
+ * Division that behaves like the bytecode interpreter's (and incremental.c's
+ * regions): INT_MIN / -1 wraps around instead of being undefined, and
+ * division by zero makes the program return 1.
+ *
+ * Unlike a region, the program doesn't branch away at each division, since
+ * thousands of small blocks make code generation very slow.  A zero divisor
+ * is replaced like -1 is, and only noted in divided_by_zero, which is
+ * checked once at the end.
+ */
+static LLVMValueRef emit_division(llvm_emitter& emitter, LLVMValueRef lhs, LLVMValueRef rhs) {
+    LLVMBuilderRef builder = emitter.builder;
+    LLVMValueRef zero = LLVMConstInt(emitter.int_type, 0, 0);
+    LLVMValueRef minus_one = LLVMConstInt(emitter.int_type, (uint64_t)-1, 1);
+    LLVMValueRef is_zero = LLVMBuildICmp(builder, LLVMIntEQ, rhs, zero, "is_zero");
+    LLVMValueRef is_minus_one = LLVMBuildICmp(builder, LLVMIntEQ, rhs, minus_one, "is_minus_one");
+    emitter.divided_by_zero = emitter.divided_by_zero
+        ? LLVMBuildOr(builder, emitter.divided_by_zero, is_zero, "divided_by_zero")
+        : is_zero;
+
+    LLVMValueRef replace = LLVMBuildOr(builder, is_zero, is_minus_one, "replace");
+    LLVMValueRef divisor = LLVMBuildSelect(builder, replace, LLVMConstInt(emitter.int_type, 1, 0), rhs, "divisor");
+    LLVMValueRef quotient = LLVMBuildSDiv(builder, lhs, divisor, "quotient");
+    LLVMValueRef negated = LLVMBuildSub(builder, zero, lhs, "negated");
+    return LLVMBuildSelect(builder, is_minus_one, negated, quotient, operation_name(AST_DIV));
+}
+
+/*
+ * Since nodes are shared (see ast.h), a node that was already emitted is
+ * simply reused.  All of the statements are in one block, and a shared
+ * variable reference always reads the same version of the variable, so the
+ * earlier value is still the right one.
+ *
+ * The tree can be nested too deeply to recurse (see ast_optimize()), so a
+ * node waits on an explicit stack until its operands are built.  The left
+ * operand is built first, as it would be by recursion.
+ */
+static LLVMValueRef emit_llvm_expression(llvm_emitter& emitter, int32_t root) {
+    const ast& tree = emitter.tree;
+    emitter.pending.push_back(root);
+    while (!emitter.pending.empty()) {
+        int32_t node = emitter.pending.back();
+        if (emitter.values[node]) {
+            emitter.pending.pop_back();
+            continue;
+        }
+
+        uint8_t op = tree.op[node];
+        LLVMValueRef value = NULL;
+        if (op == AST_INTEGER) {
+            value = LLVMConstInt(emitter.int_type, (uint32_t)tree.literal_values[tree.value[node]], 1);
+        } else if (op == AST_VARIABLE) {
+            int32_t symbol = tree.value[node];
+            value = LLVMBuildLoad2(emitter.builder, emitter.int_type, emitter.variables[symbol], tree.symbol_names[symbol].c_str());
+        } else {
+            LLVMValueRef lhs = emitter.values[tree.left[node]];
+            LLVMValueRef rhs = emitter.values[tree.right[node]];
+            if (!lhs || !rhs) {
+                if (!rhs) emitter.pending.push_back(tree.right[node]);
+                if (!lhs) emitter.pending.push_back(tree.left[node]);
+                continue;
+            }
+            switch (op) {
+            case AST_ADD: value = LLVMBuildAdd(emitter.builder, lhs, rhs, operation_name(op)); break;
+            case AST_SUB: value = LLVMBuildSub(emitter.builder, lhs, rhs, operation_name(op)); break;
+            case AST_MUL: value = LLVMBuildMul(emitter.builder, lhs, rhs, operation_name(op)); break;
+            default: value = emit_division(emitter, lhs, rhs); break;
+            }
+        }
+        emitter.values[node] = value;
+        emitter.pending.pop_back();
+    }
+    return emitter.values[root];
+}
+
+LLVMModuleRef build_llvm_module(const ast& tree, LLVMContextRef context) {
+    LLVMModuleRef module = LLVMModuleCreateWithNameInContext("lecture.code.parser", context);
+    llvm_emitter emitter = { tree, context, LLVMCreateBuilderInContext(context), LLVMInt32TypeInContext(context), NULL, {}, {}, {} };
+
+    LLVMTypeRef vars_type = LLVMPointerType(emitter.int_type, 0);
+    LLVMTypeRef program_sig = LLVMFunctionType(emitter.int_type, &vars_type, 1, 0);
+    LLVMValueRef program_fn = LLVMAddFunction(module, "program", program_sig);
+    LLVMValueRef vars = LLVMGetParam(program_fn, 0);
+    LLVMSetValueName2(vars, "vars", 4);
+    LLVMBasicBlockRef block = LLVMAppendBasicBlockInContext(context, program_fn, "block");
+    LLVMPositionBuilderAtEnd(emitter.builder, block);
+
+    emitter.values.assign(tree.num_nodes(), NULL);
+    emitter.variables.resize(tree.num_symbols());
+    for (size_t symbol = 0; symbol < tree.num_symbols(); symbol++) {
+        emitter.variables[symbol] = LLVMBuildAlloca(emitter.builder, emitter.int_type, tree.symbol_names[symbol].c_str());
+    }
+    // A variable that is read before it's assigned reads its initial value
+    // from vars.
+    for (size_t symbol = 0; symbol < tree.num_symbols(); symbol++) {
+        LLVMValueRef index = LLVMConstInt(LLVMInt64TypeInContext(context), symbol, 0);
+        LLVMValueRef slot = LLVMBuildGEP2(emitter.builder, emitter.int_type, vars, &index, 1, "slot");
+        LLVMValueRef initial = LLVMBuildLoad2(emitter.builder, emitter.int_type, slot, "initial");
+        LLVMBuildStore(emitter.builder, initial, emitter.variables[symbol]);
+    }
+
+    for (size_t s = 0; s < tree.num_statements(); s++) {
+        LLVMValueRef value = emit_llvm_expression(emitter, tree.stmt_value[s]);
+        LLVMBuildStore(emitter.builder, value, emitter.variables[tree.stmt_target[s]]);
+    }
+
+    if (emitter.divided_by_zero) {
+        LLVMBasicBlockRef division_by_zero = LLVMAppendBasicBlockInContext(context, program_fn, "division_by_zero");
+        LLVMBasicBlockRef done = LLVMAppendBasicBlockInContext(context, program_fn, "done");
+        LLVMBuildCondBr(emitter.builder, emitter.divided_by_zero, division_by_zero, done);
+        LLVMPositionBuilderAtEnd(emitter.builder, division_by_zero);
+        LLVMBuildRet(emitter.builder, LLVMConstInt(emitter.int_type, 1, 0));
+        LLVMPositionBuilderAtEnd(emitter.builder, done);
+    }
+
+    for (size_t symbol = 0; symbol < tree.num_symbols(); symbol++) {
+        const char* name = tree.symbol_names[symbol].c_str();
+        LLVMValueRef value = LLVMBuildLoad2(emitter.builder, emitter.int_type, emitter.variables[symbol], name);
+        LLVMValueRef index = LLVMConstInt(LLVMInt64TypeInContext(context), symbol, 0);
+        LLVMValueRef slot = LLVMBuildGEP2(emitter.builder, emitter.int_type, vars, &index, 1, "slot");
+        LLVMBuildStore(emitter.builder, value, slot);
+    }
+    LLVMBuildRet(emitter.builder, LLVMConstInt(emitter.int_type, 0, 0));
+
+    LLVMDisposeBuilder(emitter.builder);
+    LLVMVerifyModule(module, LLVMAbortProcessAction, NULL);
+    return module;
+}
+
+void emit_llvm(const ast& tree, std::ostream& out) {
+    LLVMContextRef context = LLVMContextCreate();
+    LLVMModuleRef module = build_llvm_module(tree, context);
+
+    char* moduleString = LLVMPrintModuleToString(module);
+    out << moduleString;
+    out.flush();
+
+    LLVMDisposeMessage(moduleString);
+    LLVMDisposeModule(module);
+    LLVMContextDispose(context);
+}
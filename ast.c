@@ -0,0 +1,401 @@
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "ast.h"
+
+ast program;
+
+int32_t ast_symbol(const std::string& name) {
+    auto inserted = program.symbol_ids.emplace(name, program.symbol_names.size());
+    if (inserted.second) {
+        program.symbol_names.push_back(name);
+        program.symbol_versions.push_back(0);
+    }
+    return inserted.first->second;
+}
+
+/*
+ * Like C, literals that don't fit in an int wrap around.
+ */
+int32_t ast_literal(const std::string& text) {
+    auto inserted = program.literal_ids.emplace(text, program.literal_texts.size());
+    if (inserted.second) {
+        program.literal_texts.push_back(text);
+        program.literal_values.push_back((int32_t)strtoull(text.c_str(), NULL, 10));
+    }
+    return inserted.first->second;
+}
+
+/*
+ * The last step mixes value into the low bits, which pick the slot.
+ * Without it, the literals that folding creates one after another (which
+ * differ only in value) would land in consecutive slots and make one long
+ * cluster for the linear probing to walk.
+ */
+static size_t hash_node(uint8_t op, int32_t left, int32_t right, int32_t value) {
+    uint64_t h = op;
+    h = h * 0x9E3779B97F4A7C15ULL + (uint32_t)left;
+    h = h * 0x9E3779B97F4A7C15ULL + (uint32_t)right;
+    h = h * 0x9E3779B97F4A7C15ULL + (uint32_t)value;
+    h = (h ^ (h >> 29)) * 0xBF58476D1CE4E5B9ULL;
+    return h ^ (h >> 32);
+}
+
+static size_t node_slot(uint8_t op, int32_t left, int32_t right, int32_t value) {
+    size_t mask = program.node_table.size() - 1;
+    size_t slot = hash_node(op, left, right, value) & mask;
+    for (;;) {
+        int32_t node = program.node_table[slot];
+        if (node < 0 || (program.op[node] == op && program.left[node] == left
+                && program.right[node] == right && program.value[node] == value)) {
+            return slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+/*
+ * The table is kept at most half full, and doubles (rehashing every node)
+ * when it would get fuller than that.
+ */
+static void grow_node_table() {
+    size_t size = program.node_table.empty() ? 1024 : program.node_table.size() * 2;
+    program.node_table.assign(size, -1);
+    for (size_t node = 0; node < program.num_nodes(); node++) {
+        size_t slot = node_slot(program.op[node], program.left[node], program.right[node], program.value[node]);
+        program.node_table[slot] = node;
+    }
+}
+
+/*
+ * Returns the node with the given contents, creating it if it doesn't exist
+ * yet.
+ */
+static int32_t add_node(ast_op op, int32_t left, int32_t right, int32_t value) {
+    if (2 * (program.num_nodes() + 1) > program.node_table.size()) {
+        grow_node_table();
+    }
+    size_t slot = node_slot(op, left, right, value);
+    if (program.node_table[slot] >= 0) {
+        return program.node_table[slot];
+    }
+
+    program.op.push_back(op);
+    program.left.push_back(left);
+    program.right.push_back(right);
+    program.value.push_back(value);
+    program.node_table[slot] = program.op.size() - 1;
+    return program.op.size() - 1;
+}
+
+int32_t ast_integer(const std::string& text) {
+    return add_node(AST_INTEGER, -1, -1, ast_literal(text));
+}
+
+int32_t ast_variable(const std::string& name) {
+    int32_t symbol = ast_symbol(name);
+    return add_node(AST_VARIABLE, program.symbol_versions[symbol], -1, symbol);
+}
+
+int32_t ast_binary(ast_op op, int32_t left, int32_t right) {
+    return add_node(op, left, right, -1);
+}
+
+void ast_reset() {
+    program.op.clear();
+    program.left.clear();
+    program.right.clear();
+    program.value.clear();
+    program.stmt_target.clear();
+    program.stmt_value.clear();
+    program.symbol_names.clear();
+    program.symbol_ids.clear();
+    program.literal_texts.clear();
+    program.literal_values.clear();
+    program.literal_ids.clear();
+    program.symbol_versions.clear();
+    std::fill(program.node_table.begin(), program.node_table.end(), -1);
+}
+
+void ast_assign(const std::string& name, int32_t value) {
+    int32_t symbol = ast_symbol(name);
+    program.stmt_target.push_back(symbol);
+    program.stmt_value.push_back(value);
+    program.symbol_versions[symbol]++;
+}
+
+/*
+ * Computes lhs op rhs the way the generated code would, with int arithmetic
+ * that wraps around.  Returns false (and leaves the division to run time) if
+ * it would divide by zero or overflow.
+ */
+static bool fold_operation(uint8_t op, int32_t lhs, int32_t rhs, int32_t* result) {
+    switch (op) {
+    case AST_ADD: *result = (int32_t)((uint32_t)lhs + (uint32_t)rhs); return true;
+    case AST_SUB: *result = (int32_t)((uint32_t)lhs - (uint32_t)rhs); return true;
+    case AST_MUL: *result = (int32_t)((uint32_t)lhs * (uint32_t)rhs); return true;
+    default:
+        if (rhs == 0 || (lhs == INT_MIN && rhs == -1)) {
+            return false;
+        }
+        *result = lhs / rhs;
+        return true;
+    }
+}
+
+struct constant_folder {
+    std::vector<int32_t> folded;      // Folded node for each node, or -1
+    std::vector<int32_t> constants;   // Current constant of each symbol, or -1
+    std::vector<int32_t> pending;     // Nodes waiting for their operands
+};
+
+/*
+ * Returns node with every constant variable replaced by its value and every
+ * operation on constants computed.  A variable node names one version of
+ * the variable, which is the current one whenever the node is used, so the
+ * result can be remembered for the whole program.
+ *
+ * Expressions can be nested far deeper than the call stack allows (a long
+ * chain of additions is as deep as it is long), so instead of recursing, a
+ * node waits on an explicit stack until both of its operands are folded.
+ */
+static int32_t fold_expression(constant_folder& folder, int32_t root) {
+    folder.pending.push_back(root);
+    while (!folder.pending.empty()) {
+        int32_t node = folder.pending.back();
+        if (folder.folded[node] >= 0) {
+            folder.pending.pop_back();
+            continue;
+        }
+
+        int32_t result = node;
+        uint8_t op = program.op[node];
+        if (op == AST_VARIABLE) {
+            int32_t constant = folder.constants[program.value[node]];
+            if (constant >= 0) {
+                result = constant;
+            }
+        } else if (op != AST_INTEGER) {
+            int32_t left = folder.folded[program.left[node]];
+            int32_t right = folder.folded[program.right[node]];
+            if (left < 0 || right < 0) {
+                if (left < 0) folder.pending.push_back(program.left[node]);
+                if (right < 0) folder.pending.push_back(program.right[node]);
+                continue;
+            }
+            int32_t value;
+            if (program.op[left] == AST_INTEGER && program.op[right] == AST_INTEGER
+                && fold_operation(op, program.literal_values[program.value[left]],
+                                  program.literal_values[program.value[right]], &value)) {
+                result = ast_integer(std::to_string(value));
+            } else {
+                result = ast_binary((ast_op)op, left, right);
+            }
+        }
+
+        // Folding may have added nodes.
+        folder.folded.resize(program.num_nodes(), -1);
+        folder.folded[node] = result;
+        folder.pending.pop_back();
+    }
+    return folder.folded[root];
+}
+
+/*
+ * Marks the variables that node reads as live.  Like fold_expression(), this
+ * uses an explicit stack rather than recursion.
+ *
+ * A node only needs to be visited once for the whole program: the variable
+ * versions it reads are current wherever it is used, so none of them can be
+ * assigned (and marked dead) between two of its uses.
+ */
+static void mark_reads(const ast& tree, int32_t root, std::vector<bool>& live,
+                       std::vector<bool>& visited, std::vector<int32_t>& pending) {
+    pending.push_back(root);
+    while (!pending.empty()) {
+        int32_t node = pending.back();
+        pending.pop_back();
+        if (visited[node]) {
+            continue;
+        }
+        visited[node] = true;
+        uint8_t op = tree.op[node];
+        if (op == AST_VARIABLE) {
+            live[tree.value[node]] = true;
+        } else if (op != AST_INTEGER) {
+            pending.push_back(tree.left[node]);
+            pending.push_back(tree.right[node]);
+        }
+    }
+}
+
+void ast_optimize() {
+    // Constant propagation, forwards through the statements.  A variable
+    // that was never assigned isn't known to be anything, so it is left
+    // alone.
+    constant_folder folder;
+    folder.folded.assign(program.num_nodes(), -1);
+    folder.constants.assign(program.num_symbols(), -1);
+    for (size_t s = 0; s < program.num_statements(); s++) {
+        int32_t value = fold_expression(folder, program.stmt_value[s]);
+        program.stmt_value[s] = value;
+        folder.constants[program.stmt_target[s]] = program.op[value] == AST_INTEGER ? value : -1;
+    }
+
+    // Dead-store elimination, backwards.  The final value of every variable
+    // is the program's result, so all variables are live at the end.
+    std::vector<bool> live(program.num_symbols(), true);
+    std::vector<bool> keep(program.num_statements(), false);
+    std::vector<bool> visited(program.num_nodes(), false);
+    for (size_t s = program.num_statements(); s-- > 0;) {
+        int32_t target = program.stmt_target[s];
+        if (live[target]) {
+            keep[s] = true;
+            live[target] = false;
+            mark_reads(program, program.stmt_value[s], live, visited, folder.pending);
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t s = 0; s < program.num_statements(); s++) {
+        if (keep[s]) {
+            program.stmt_target[kept] = program.stmt_target[s];
+            program.stmt_value[kept] = program.stmt_value[s];
+            kept++;
+        }
+    }
+    program.stmt_target.resize(kept);
+    program.stmt_value.resize(kept);
+}
+
+static int precedence(uint8_t op) {
+    switch (op) {
+    case AST_ADD:
+    case AST_SUB:
+        return 1;
+    case AST_MUL:
+    case AST_DIV:
+        return 2;
+    default:
+        return 3;
+    }
+}
+
+static const char* operator_text(uint8_t op) {
+    switch (op) {
+    case AST_ADD: return " + ";
+    case AST_SUB: return " - ";
+    case AST_MUL: return " * ";
+    default: return " / ";
+    }
+}
+
+/*
+ * Words that C++ reserves but Python doesn't (the ones Python reserves never
+ * make it past the scanner), in strcmp() order.
+ */
+static const char* const cpp_keywords[] = {
+    "alignas", "alignof", "and_eq", "asm", "auto", "bitand", "bitor", "bool",
+    "case", "catch", "char", "char16_t", "char32_t", "char8_t", "co_await",
+    "co_return", "co_yield", "compl", "concept", "const", "const_cast",
+    "consteval", "constexpr", "constinit", "decltype", "default", "delete",
+    "do", "double", "dynamic_cast", "enum", "explicit", "export", "extern",
+    "false", "float", "friend", "goto", "inline", "int", "long", "mutable",
+    "namespace", "new", "noexcept", "not_eq", "nullptr", "operator", "or_eq",
+    "private", "protected", "public", "register", "reinterpret_cast",
+    "requires", "short", "signed", "sizeof", "static", "static_assert",
+    "static_cast", "struct", "switch", "template", "this", "thread_local",
+    "throw", "true", "typedef", "typeid", "typename", "union", "unsigned",
+    "using", "virtual", "void", "volatile", "wchar_t", "xor", "xor_eq",
+};
+
+/*
+ * The C++ name of a variable.  A C++ keyword gets a "_" appended, and so
+ * does a name that already ends in one, so no two names end up the same.
+ */
+static std::string cpp_name(const std::string& name) {
+    bool reserved = std::binary_search(std::begin(cpp_keywords), std::end(cpp_keywords), name.c_str(),
+        [](const char* a, const char* b) { return strcmp(a, b) < 0; });
+    return reserved || name.back() == '_' ? name + "_" : name;
+}
+
+/*
+ * Something left to print: a node, or (if node is -1) a piece of text.
+ */
+struct cpp_item {
+    int32_t node;
+    const char* text;
+};
+
+/*
+ * The tree doesn't keep the source's parentheses, so they are put back where
+ * the C++ precedence rules need them.  All of the operators are
+ * left-associative, so a right operand at the same level needs them too.
+ *
+ * Like the passes in ast_optimize(), this doesn't recurse: an operation is
+ * replaced on the stack by its operands and the text around them, pushed in
+ * reverse so they come off in the order they're printed.
+ */
+static void emit_cpp_expression(const ast& tree, int32_t root, const std::vector<std::string>& names,
+                                std::ostream& out, std::vector<cpp_item>& pending) {
+    pending.push_back({ root, NULL });
+    while (!pending.empty()) {
+        cpp_item item = pending.back();
+        pending.pop_back();
+        int32_t node = item.node;
+        if (node < 0) {
+            out << item.text;
+            continue;
+        }
+
+        uint8_t op = tree.op[node];
+        if (op == AST_INTEGER) {
+            out << tree.literal_texts[tree.value[node]];
+            continue;
+        } else if (op == AST_VARIABLE) {
+            out << names[tree.value[node]];
+            continue;
+        }
+
+        int32_t left = tree.left[node];
+        int32_t right = tree.right[node];
+        bool left_parens = precedence(tree.op[left]) < precedence(op);
+        bool right_parens = precedence(tree.op[right]) <= precedence(op);
+
+        // Folding can produce negative literals, which can't directly follow
+        // an operator.
+        if (tree.op[right] == AST_INTEGER && tree.literal_texts[tree.value[right]][0] == '-') {
+            right_parens = true;
+        }
+
+        if (right_parens) pending.push_back({ -1, ")" });
+        pending.push_back({ right, NULL });
+        if (right_parens) pending.push_back({ -1, "(" });
+        pending.push_back({ -1, operator_text(op) });
+        if (left_parens) pending.push_back({ -1, ")" });
+        pending.push_back({ left, NULL });
+        if (left_parens) pending.push_back({ -1, "(" });
+    }
+}
+
+void emit_cpp(const ast& tree, std::ostream& out) {
+    std::vector<bool> declared(tree.num_symbols(), false);
+    std::vector<std::string> names;
+    for (const std::string& name : tree.symbol_names) {
+        names.push_back(cpp_name(name));
+    }
+    std::vector<cpp_item> pending;
+    for (size_t s = 0; s < tree.num_statements(); s++) {
+        int32_t target = tree.stmt_target[s];
+        if (!declared[target]) {
+            declared[target] = true;
+            out << "int ";
+        }
+        out << names[target] << " = ";
+        emit_cpp_expression(tree, tree.stmt_value[s], names, out, pending);
+        out << ";\n";
+    }
+    out.flush();
+}
@@ -0,0 +1,128 @@
+/*
+ * Abstract syntax tree built by parser.y.
+ *
+ * Instead of one heap-allocated object per node, the whole program lives in
+ * a handful of parallel arrays indexed by node ID: op[n] is the kind of node
+ * n, left[n] and right[n] are the IDs of its operands, and value[n] is the
+ * literal or symbol ID of a leaf.  Adding a node appends one entry to each
+ * array, so building the tree doesn't allocate per node, and walking it
+ * touches memory in order.
+ *
+ * Nodes are only ever created after their operands, so the operands of node
+ * n always have IDs smaller than n.
+ *
+ * Nodes are also hash-consed: asking for a node that is identical to an
+ * existing one returns the existing node, so a subexpression that appears
+ * several times in the program is stored only once, and the LLVM and
+ * bytecode translations compute it only once.  (emit_cpp() still prints it
+ * out in full at every use.)  For this to be safe, a variable reference is
+ * identified by the variable and by how many times it has been assigned so
+ * far (its version).  An assignment bumps the version, so expressions that
+ * read the old value are never shared with ones that read the new value.
+ */
+
+#ifndef AST_H
+#define AST_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum ast_op : uint8_t {
+    AST_INTEGER,    // value is a literal ID
+    AST_VARIABLE,   // value is a symbol ID, left is the variable's version
+    AST_ADD,
+    AST_SUB,
+    AST_MUL,
+    AST_DIV
+};
+
+struct ast {
+    // Nodes
+    std::vector<uint8_t> op;
+    std::vector<int32_t> left;
+    std::vector<int32_t> right;
+    std::vector<int32_t> value;
+
+    // Statements, in program order: symbol stmt_target[s] is assigned the
+    // value of node stmt_value[s].
+    std::vector<int32_t> stmt_target;
+    std::vector<int32_t> stmt_value;
+
+    // Interned symbol names and integer literals
+    std::vector<std::string> symbol_names;
+    std::unordered_map<std::string, int32_t> symbol_ids;
+    std::vector<std::string> literal_texts;
+    std::vector<int32_t> literal_values;
+    std::unordered_map<std::string, int32_t> literal_ids;
+
+    // For hash-consing: the current version of each symbol, and an open
+    // addressing hash table of node IDs (-1 for empty slots).
+    std::vector<int32_t> symbol_versions;
+    std::vector<int32_t> node_table;
+
+    size_t num_nodes() const { return op.size(); }
+    size_t num_statements() const { return stmt_target.size(); }
+    size_t num_symbols() const { return symbol_names.size(); }
+};
+
+/*
+ * The program being parsed.
+ */
+extern ast program;
+
+int32_t ast_symbol(const std::string& name);
+int32_t ast_literal(const std::string& text);
+
+int32_t ast_integer(const std::string& text);
+int32_t ast_variable(const std::string& name);
+int32_t ast_binary(ast_op op, int32_t left, int32_t right);
+void ast_assign(const std::string& name, int32_t value);
+
+/*
+ * Empties the program so another one can be parsed, keeping the memory that
+ * has already been allocated for it.
+ */
+void ast_reset();
+
+/*
+ * Simplifies the program without changing the final values of its
+ * variables: known constant values are propagated into the expressions that
+ * use them and folded, and assignments that are overwritten before they are
+ * read are removed.
+ */
+void ast_optimize();
+
+/*
+ * Writes the program as C++ statements, declaring each variable at its first
+ * assignment.  Variables named like C++ keywords are renamed (see cpp_name()
+ * in ast.c).
+ */
+void emit_cpp(const ast& tree, std::ostream& out);
+
+#ifdef EMIT_LLVM
+#include <llvm-c/Core.h>
+
+/*
+ * Builds the program as an LLVM module with a single function,
+ *
+ *   int32_t program(int32_t* vars)
+ *
+ * which runs the statements on the variables in vars[symbol ID]: a variable
+ * that is read before it's assigned reads its initial value there, like in
+ * run_bytecode().  Then it stores the final value of every variable back
+ * into vars and returns 0.  If the program divides by zero, it returns 1
+ * instead, without storing anything, like run_bytecode() returning false.
+ * See ast-llvm.c.
+ */
+LLVMModuleRef build_llvm_module(const ast& tree, LLVMContextRef context);
+
+/*
+ * Writes the program as LLVM IR.
+ */
+void emit_llvm(const ast& tree, std::ostream& out);
+#endif
+
+#endif
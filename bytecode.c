@@ -0,0 +1,126 @@
+/*
+ * Compiles the AST into register bytecode (see bytecode.h) and interprets it
+ * with threaded dispatch: each instruction's handler jumps straight to the
+ * handler of the next one through a table of label addresses, instead of
+ * going back through a single switch.  That needs GCC's computed goto
+ * extension, so other compilers fall back to a switch in a loop.
+ */
+
+#include <algorithm>
+#include <climits>
+#include "bytecode.h"
+
+struct bytecode_compiler {
+    const ast& tree;
+    bytecode& program;
+    std::vector<int32_t> registers;   // Register holding each node's value, or -1
+    std::vector<int32_t> pending;     // Nodes waiting for their operands
+};
+
+/*
+ * Returns the register that holds the value of node, emitting the code to
+ * compute it the first time it's needed.  Since nodes are shared (see ast.h),
+ * a subexpression that appears several times is computed only once, and its
+ * temporary is never overwritten.
+ *
+ * The tree can be nested too deeply to recurse (see ast_optimize()), so a
+ * node waits on an explicit stack until its operands have registers.  The
+ * left operand is compiled first, as it would be by recursion.
+ */
+static uint32_t compile_expression(bytecode_compiler& compiler, int32_t root) {
+    const ast& tree = compiler.tree;
+    bytecode& program = compiler.program;
+    compiler.pending.push_back(root);
+    while (!compiler.pending.empty()) {
+        int32_t node = compiler.pending.back();
+        if (compiler.registers[node] >= 0) {
+            compiler.pending.pop_back();
+            continue;
+        }
+
+        uint8_t op = tree.op[node];
+        uint32_t reg;
+        if (op == AST_INTEGER) {
+            reg = tree.num_symbols() + tree.value[node];
+        } else if (op == AST_VARIABLE) {
+            reg = tree.value[node];
+        } else {
+            int32_t lhs = compiler.registers[tree.left[node]];
+            int32_t rhs = compiler.registers[tree.right[node]];
+            if (lhs < 0 || rhs < 0) {
+                if (rhs < 0) compiler.pending.push_back(tree.right[node]);
+                if (lhs < 0) compiler.pending.push_back(tree.left[node]);
+                continue;
+            }
+            reg = program.num_registers++;
+            uint8_t opcode = op == AST_ADD ? OP_ADD : op == AST_SUB ? OP_SUB : op == AST_MUL ? OP_MUL : OP_DIV;
+            program.code.push_back({ opcode, reg, (uint32_t)lhs, (uint32_t)rhs });
+        }
+        compiler.registers[node] = reg;
+        compiler.pending.pop_back();
+    }
+    return compiler.registers[root];
+}
+
+bytecode compile_bytecode(const ast& tree) {
+    bytecode program;
+    program.num_symbols = tree.num_symbols();
+    program.initial_registers = tree.literal_values;
+    program.num_registers = tree.num_symbols() + tree.literal_values.size();
+
+    bytecode_compiler compiler = { tree, program, std::vector<int32_t>(tree.num_nodes(), -1), {} };
+    for (size_t s = 0; s < tree.num_statements(); s++) {
+        uint32_t reg = compile_expression(compiler, tree.stmt_value[s]);
+        program.code.push_back({ OP_MOVE, (uint32_t)tree.stmt_target[s], reg, 0 });
+    }
+    program.code.push_back({ OP_HALT, 0, 0, 0 });
+    return program;
+}
+
+static inline int32_t divide(int32_t lhs, int32_t rhs) {
+    return lhs == INT_MIN && rhs == -1 ? INT_MIN : lhs / rhs;
+}
+
+bool run_bytecode(const bytecode& program, int32_t* registers) {
+    std::copy(program.initial_registers.begin(), program.initial_registers.end(), registers + program.num_symbols);
+    const instruction* ip = program.code.data();
+    int32_t* r = registers;
+
+#ifdef __GNUC__
+    static void* const handlers[] = { &&op_move, &&op_add, &&op_sub, &&op_mul, &&op_div, &&op_halt };
+#define CASE(label, opcode) label:
+#define NEXT() goto *handlers[(++ip)->opcode]
+    goto *handlers[ip->opcode];
+#else
+#define CASE(label, opcode) case opcode:
+#define NEXT() ip++; continue
+    for (;;) switch (ip->opcode) {
+#endif
+
+    CASE(op_move, OP_MOVE)
+        r[ip->dst] = r[ip->lhs];
+        NEXT();
+    CASE(op_add, OP_ADD)
+        r[ip->dst] = (int32_t)((uint32_t)r[ip->lhs] + (uint32_t)r[ip->rhs]);
+        NEXT();
+    CASE(op_sub, OP_SUB)
+        r[ip->dst] = (int32_t)((uint32_t)r[ip->lhs] - (uint32_t)r[ip->rhs]);
+        NEXT();
+    CASE(op_mul, OP_MUL)
+        r[ip->dst] = (int32_t)((uint32_t)r[ip->lhs] * (uint32_t)r[ip->rhs]);
+        NEXT();
+    CASE(op_div, OP_DIV)
+        if (r[ip->rhs] == 0) {
+            return false;
+        }
+        r[ip->dst] = divide(r[ip->lhs], r[ip->rhs]);
+        NEXT();
+    CASE(op_halt, OP_HALT)
+        return true;
+
+#ifndef __GNUC__
+    }
+#endif
+#undef CASE
+#undef NEXT
+}
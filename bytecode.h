@@ -0,0 +1,63 @@
+/*
+ * Register bytecode for the AST, and an interpreter for it.
+ *
+ * Building and JIT-compiling an LLVM module takes milliseconds, which is a
+ * lot for a program of a few lines.  Translating the AST into this bytecode
+ * and interpreting it starts in microseconds instead.
+ *
+ * Every instruction works on a file of int32_t registers, laid out as:
+ *
+ *   variables     one per symbol, by symbol ID
+ *   constants     one per integer literal, by literal ID
+ *   temporaries   one per intermediate result
+ *
+ * So after a run, the first num_symbols registers hold the final values of
+ * the variables, just like the vars array of the LLVM back end's program()
+ * function (see ast.h).
+ */
+
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <cstdint>
+#include <vector>
+#include "ast.h"
+
+enum opcode : uint8_t {
+    OP_MOVE,    // registers[dst] = registers[lhs]
+    OP_ADD,     // registers[dst] = registers[lhs] + registers[rhs]
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_HALT
+};
+
+struct instruction {
+    uint8_t opcode;
+    uint32_t dst;
+    uint32_t lhs;
+    uint32_t rhs;
+};
+
+struct bytecode {
+    std::vector<instruction> code;
+    // Initial contents of the constant registers.
+    std::vector<int32_t> initial_registers;
+    uint32_t num_symbols;
+    uint32_t num_registers;
+};
+
+bytecode compile_bytecode(const ast& tree);
+
+/*
+ * Runs the bytecode on registers, which must have room for num_registers
+ * values.  The first num_symbols of them hold the initial values of the
+ * variables, which is what a variable reads before it's assigned; the rest
+ * are initialized here.  Arithmetic wraps around, and INT_MIN / -1 is
+ * INT_MIN, the same as in the LLVM back end's code (see ast-llvm.c).
+ * Returns false if the program divides by zero, in which case it stops at
+ * that point.
+ */
+bool run_bytecode(const bytecode& program, int32_t* registers);
+
+#endif
@@ -0,0 +1,345 @@
+/*
+ * Compile service; see compile-server.h.  Requests are handled one at a time,
+ * since they all share one LLVM context.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <llvm-c/Core.h>
+#include <llvm-c/Target.h>
+#include <llvm-c/TargetMachine.h>
+#include <llvm-c/Transforms/PassBuilder.h>
+#include "ast.h"
+#include "bytecode.h"
+#include "compile-server.h"
+#include "incremental.h"
+#include "parser.h"
+
+extern int skipped_statements;
+
+/*
+ * Requests are handled one at a time, so a client that is slow to send its
+ * request or to read the reply would hold up everyone else.  Both have to be
+ * done within the timeout, and a request can't grow past the size limit.
+ */
+#define REQUEST_TIMEOUT_MS 10000
+#define MAX_REQUEST_BYTES (64 << 20)
+
+/*
+ * The server's own passes over the AST don't recurse, but some of LLVM's do
+ * (over chains of instructions), so nesting is limited too.  That is far
+ * deeper than anything written by hand.
+ */
+#define MAX_EXPRESSION_DEPTH 100000
+
+/*
+ * Everything that is set up once and used by every request.
+ */
+struct compile_server {
+    LLVMContextRef context;
+    LLVMTargetMachineRef machine;
+    char* triple;
+    char* data_layout;
+    LLVMPassBuilderOptionsRef pass_options;
+
+    // Created by the first update request, and kept so later updates can
+    // reuse what it compiled.
+    incremental_compiler* incremental;
+};
+
+static bool setup_llvm(compile_server& server) {
+    LLVMInitializeNativeTarget();
+    LLVMInitializeNativeAsmPrinter();
+
+    server.triple = LLVMGetDefaultTargetTriple();
+    char* error = NULL;
+    LLVMTargetRef target = NULL;
+    if (LLVMGetTargetFromTriple(server.triple, &target, &error)) {
+        fprintf(stderr, "Error: %s\n", error);
+        LLVMDisposeMessage(error);
+        return false;
+    }
+
+    char* cpu = LLVMGetHostCPUName();
+    char* features = LLVMGetHostCPUFeatures();
+    server.machine = LLVMCreateTargetMachine(
+        target, server.triple, cpu, features,
+        LLVMCodeGenLevelDefault, LLVMRelocPIC, LLVMCodeModelDefault
+    );
+    LLVMDisposeMessage(features);
+    LLVMDisposeMessage(cpu);
+
+    LLVMTargetDataRef data_layout = LLVMCreateTargetDataLayout(server.machine);
+    server.data_layout = LLVMCopyStringRepOfTargetData(data_layout);
+    LLVMDisposeTargetData(data_layout);
+
+    server.context = LLVMContextCreate();
+    server.pass_options = LLVMCreatePassBuilderOptions();
+    server.incremental = NULL;
+    return true;
+}
+
+/*
+ * Returns how deeply the expressions in tree are nested.  The operands of a
+ * node have smaller IDs than the node itself, so one pass in ID order sees
+ * them first.
+ */
+static uint32_t expression_depth(const ast& tree) {
+    std::vector<uint32_t> depths(tree.num_nodes());
+    uint32_t deepest = 0;
+    for (size_t node = 0; node < tree.num_nodes(); node++) {
+        uint8_t op = tree.op[node];
+        depths[node] = op == AST_INTEGER || op == AST_VARIABLE ? 1
+            : 1 + std::max(depths[tree.left[node]], depths[tree.right[node]]);
+        deepest = std::max(deepest, depths[node]);
+    }
+    return deepest;
+}
+
+/*
+ * Parses a program into the global AST, reusing the AST's storage.  Returns
+ * false, with error set, if it is nested too deeply, either for the parser's
+ * stack or for MAX_EXPRESSION_DEPTH.
+ */
+static bool parse(const char* text, size_t length, std::string& error) {
+    FILE* input = fmemopen((void*)text, length, "r");
+    ast_reset();
+    skipped_statements = 0;
+    restart_scanner(input);
+    int status = yyparse();
+    fclose(input);
+    // yyparse() only gives up with 2 when its stack is full.
+    if (status == 2 || expression_depth(program) > MAX_EXPRESSION_DEPTH) {
+        error = "expression nested too deeply";
+        return false;
+    }
+    ast_optimize();
+    return true;
+}
+
+static bool run_program(std::string& result, std::string& error) {
+    // A variable that is read before it's assigned reads as 0.
+    bytecode code = compile_bytecode(program);
+    std::vector<int32_t> registers(code.num_registers);
+    if (!run_bytecode(code, registers.data())) {
+        error = "division by zero";
+        return false;
+    }
+    for (size_t symbol = 0; symbol < program.num_symbols(); symbol++) {
+        result += program.symbol_names[symbol] + " = " + std::to_string(registers[symbol]) + "\n";
+    }
+    return true;
+}
+
+static bool compile_program(compile_server& server, bool object, std::string& result, std::string& error) {
+    LLVMModuleRef module = build_llvm_module(program, server.context);
+    bool ok = true;
+    if (!object) {
+        char* text = LLVMPrintModuleToString(module);
+        result = text;
+        LLVMDisposeMessage(text);
+    } else {
+        LLVMSetTarget(module, server.triple);
+        LLVMSetDataLayout(module, server.data_layout);
+        LLVMErrorRef pass_error = LLVMRunPasses(module, "default<O2>", server.machine, server.pass_options);
+        if (pass_error) {
+            char* message = LLVMGetErrorMessage(pass_error);
+            error = message;
+            LLVMDisposeErrorMessage(message);
+            ok = false;
+        }
+
+        char* message = NULL;
+        LLVMMemoryBufferRef buffer = NULL;
+        if (ok && LLVMTargetMachineEmitToMemoryBuffer(server.machine, module, LLVMObjectFile, &message, &buffer)) {
+            error = message;
+            LLVMDisposeMessage(message);
+            ok = false;
+        } else if (ok) {
+            result.assign(LLVMGetBufferStart(buffer), LLVMGetBufferSize(buffer));
+            LLVMDisposeMemoryBuffer(buffer);
+        }
+    }
+    LLVMDisposeModule(module);
+    return ok;
+}
+
+/*
+ * Runs the program with incremental compilation.  The result starts with a
+ * line saying how many of its regions had to be compiled.
+ */
+static bool update_program(compile_server& server, std::string& result, std::string& error) {
+    if (!server.incremental) {
+        server.incremental = incremental_create(server.context, server.machine);
+        if (!server.incremental) {
+            error = "can't set up the JIT";
+            return false;
+        }
+    }
+
+    incremental_stats stats;
+    if (!incremental_update(server.incremental, program, &stats)) {
+        error = "code generation failed";
+        return false;
+    }
+    std::vector<int32_t> vars(program.num_symbols());
+    if (!incremental_run(server.incremental, vars.data(), vars.size())) {
+        error = "division by zero";
+        return false;
+    }
+
+    result = "regions = " + std::to_string(stats.regions) + ", compiled = " + std::to_string(stats.compiled) + "\n";
+    for (size_t symbol = 0; symbol < program.num_symbols(); symbol++) {
+        result += program.symbol_names[symbol] + " = " + std::to_string(vars[symbol]) + "\n";
+    }
+    fprintf(stderr, "update: %zu of %zu regions compiled, %zu evicted\n", stats.compiled, stats.regions, stats.evicted);
+    return true;
+}
+
+/*
+ * Returns false if the client went away or stopped reading.
+ */
+static bool write_all(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+/*
+ * Reads the request until the client shuts down its side of the connection.
+ * Returns false, with error set, if that takes too long, the request gets
+ * too large, or reading fails.
+ */
+static bool read_request(int client, std::string& request, std::string& error) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(REQUEST_TIMEOUT_MS);
+    char chunk[1 << 16];
+    for (;;) {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        pollfd readable = { client, POLLIN, 0 };
+        int ready = remaining.count() > 0 ? poll(&readable, 1, remaining.count()) : 0;
+        if (ready == 0) {
+            error = "request timed out";
+            return false;
+        }
+        ssize_t n = ready > 0 ? read(client, chunk, sizeof(chunk)) : -1;
+        if (n == 0) {
+            return true;
+        } else if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error = strerror(errno);
+            return false;
+        }
+        if (request.size() + n > MAX_REQUEST_BYTES) {
+            error = "request too large";
+            return false;
+        }
+        request.append(chunk, n);
+    }
+}
+
+static void handle_request(compile_server& server, int client, std::string& request) {
+    request.clear();
+    std::string read_error;
+    if (!read_request(client, request, read_error)) {
+        std::string header = "ERROR " + read_error + "\n";
+        write_all(client, header.data(), header.size());
+        fprintf(stderr, "Error: %s\n", read_error.c_str());
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+
+    size_t newline = request.find('\n');
+    std::string command = request.substr(0, newline);
+    size_t program_start = newline == std::string::npos ? request.size() : newline + 1;
+
+    std::string result, error;
+    bool ok = false;
+    if (command == "run" || command == "update" || command == "ir" || command == "object") {
+        if (!parse(request.data() + program_start, request.size() - program_start, error)) {
+            // Nothing to run or compile
+        } else if (command == "run") {
+            ok = run_program(result, error);
+        } else if (command == "update") {
+            ok = update_program(server, result, error);
+        } else {
+            ok = compile_program(server, command == "object", result, error);
+        }
+    } else {
+        error = "unknown command '" + command + "'";
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    std::string header;
+    if (ok) {
+        header = "OK " + std::to_string(result.size()) + " " + std::to_string(skipped_statements)
+            + " " + std::to_string(elapsed.count()) + "\n";
+    } else {
+        header = "ERROR " + error + "\n";
+    }
+    if (!write_all(client, header.data(), header.size()) || !write_all(client, result.data(), result.size())) {
+        fprintf(stderr, "%s: client went away before reading the reply\n", command.c_str());
+    }
+    fprintf(stderr, "%s: %lld us\n", command.c_str(), (long long)elapsed.count());
+}
+
+int serve(const char* path) {
+    compile_server server;
+    if (!setup_llvm(server)) {
+        return 1;
+    }
+
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Error: socket path too long: %s\n", path);
+        return 1;
+    }
+    strcpy(address.sun_path, path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if (listener < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) < 0 || listen(listener, 16) < 0) {
+        perror(path);
+        return 1;
+    }
+    fprintf(stderr, "Serving on %s\n", path);
+
+    // Writing to a client that has hung up should fail like any other write,
+    // instead of killing the server with SIGPIPE.
+    signal(SIGPIPE, SIG_IGN);
+
+    // The request buffer is kept too, so it only grows.
+    std::string request;
+    for (;;) {
+        int client = accept(listener, NULL, NULL);
+        if (client < 0) {
+            continue;
+        }
+        timeval send_timeout = { REQUEST_TIMEOUT_MS / 1000, 0 };
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+        handle_request(server, client, request);
+        close(client);
+    }
+}
@@ -0,0 +1,48 @@
+/*
+ * Compile service.
+ *
+ * Starting a process and setting up LLVM for every program costs much more
+ * than compiling a small program.  Instead, the parser can run as a server
+ * on a Unix domain socket, and keep its LLVM context, target machine and AST
+ * storage from one request to the next:
+ *
+ *   ./parser --serve /tmp/parser.sock
+ *
+ * A client connects, sends a command on the first line followed by the
+ * program, and shuts down its side of the connection.  The commands are:
+ *
+ *   run       run the program and return the final value of each variable
+ *   update    like run, but compile the program to machine code first,
+ *             reusing the code compiled for earlier requests wherever the
+ *             program hasn't changed (see incremental.h)
+ *   ir        return the program as LLVM IR
+ *   object    return the program as an optimized object file for this host
+ *
+ * For example:
+ *
+ *   (echo run; cat source.py) | socat - UNIX-CONNECT:/tmp/parser.sock
+ *
+ * The reply is a header line followed by the result:
+ *
+ *   OK <result bytes> <skipped statements> <microseconds>
+ *   ERROR <message>
+ *
+ * The time is how long the request took the server, from reading the
+ * request to having the result ready.
+ *
+ * Requests are handled one at a time.  A client has 10 seconds to send its
+ * request, which can be at most 64 MiB, and 10 seconds to take the reply;
+ * otherwise it gets an ERROR reply or is simply dropped.  Expressions can be
+ * nested at most 100,000 levels deep.
+ */
+
+#ifndef COMPILE_SERVER_H
+#define COMPILE_SERVER_H
+
+/*
+ * Serves requests on a socket at path until the process is killed.  Only
+ * returns (with 1) if the socket can't be set up.
+ */
+int serve(const char* path);
+
+#endif
@@ -0,0 +1,356 @@
+/*
+ * Compressed input for the flex scanners; see compressed-input.h.  This file
+ * is plain C, so it can be built with counter.c by gcc as well as with the
+ * parser by g++.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef READAHEAD
+#include <pthread.h>
+#endif
+#include "compressed-input.h"
+
+enum input_format {
+    FORMAT_PLAIN,
+    FORMAT_TERMINAL,
+    FORMAT_GZIP,
+    FORMAT_ZSTD
+};
+
+struct compressed_input {
+    FILE* file;         // NULL until the first read of an input
+    int format;
+    int ended;
+
+    // Compressed bytes read from the file and not yet decompressed
+    unsigned char in[COMPRESSED_INPUT_BLOCK];
+    size_t in_start;
+    size_t in_end;
+
+    z_stream gzip;
+#ifdef HAVE_ZSTD
+    ZSTD_DStream* zstd;
+    size_t zstd_status;     // 0 when the last frame read is complete
+#endif
+
+#ifdef READAHEAD
+    // The thread fills blocks[0] and blocks[1] in turn, and the scanner
+    // takes them in the same order.  A block is full from when the thread
+    // has filled it until the scanner has taken all of it; a full block of
+    // length 0 marks the end of the input.
+    pthread_t thread;
+    int running;
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    char blocks[2][COMPRESSED_INPUT_BLOCK];
+    size_t lengths[2];
+    int full[2];
+    int next;           // Block the scanner takes from next...
+    size_t offset;      // ...and how much of it it has already taken
+#endif
+};
+
+static struct compressed_input current;
+
+static void fail(const char* message) {
+    fprintf(stderr, "Error: %s\n", message);
+    exit(1);
+}
+
+/*
+ * Makes sure there are compressed bytes to decompress, reading more from the
+ * file if they have all been used.  Returns 0 at the end of the file.
+ */
+static int refill(struct compressed_input* input) {
+    if (input->in_start == input->in_end) {
+        input->in_start = 0;
+        input->in_end = fread(input->in, 1, COMPRESSED_INPUT_BLOCK, input->file);
+        if (ferror(input->file)) {
+            fail("can't read input");
+        }
+    }
+    return input->in_start < input->in_end;
+}
+
+/*
+ * The decompressors are also called once the file has been read to the end,
+ * since they may still hold output that didn't fit last time.
+ */
+static size_t inflate_gzip(struct compressed_input* input, char* out, size_t size) {
+    z_stream* gzip = &input->gzip;
+    gzip->next_out = (Bytef*)out;
+    gzip->avail_out = size;
+    while (gzip->avail_out > 0) {
+        refill(input);
+        gzip->next_in = input->in + input->in_start;
+        gzip->avail_in = input->in_end - input->in_start;
+        int status = inflate(gzip, Z_NO_FLUSH);
+        input->in_start = input->in_end - gzip->avail_in;
+        if (status == Z_STREAM_END) {
+            // Another member may follow this one
+            if (!refill(input)) {
+                input->ended = 1;
+                break;
+            }
+            inflateReset(gzip);
+        } else if (status == Z_BUF_ERROR) {
+            // No progress, because the file ended in the middle of a member
+            fail("truncated gzip input");
+        } else if (status != Z_OK) {
+            fail("corrupt gzip input");
+        }
+    }
+    return size - gzip->avail_out;
+}
+
+#ifdef HAVE_ZSTD
+static size_t decompress_zstd(struct compressed_input* input, char* out, size_t size) {
+    ZSTD_outBuffer output = { out, size, 0 };
+    while (output.pos < output.size) {
+        int more = refill(input);
+        if (!more && input->zstd_status == 0) {
+            input->ended = 1;
+            break;
+        }
+        size_t before = output.pos;
+        ZSTD_inBuffer in = { input->in, input->in_end, input->in_start };
+        input->zstd_status = ZSTD_decompressStream(input->zstd, &output, &in);
+        if (ZSTD_isError(input->zstd_status)) {
+            fail("corrupt zstd input");
+        }
+        input->in_start = in.pos;
+        if (!more && output.pos == before) {
+            fail("truncated zstd input");
+        }
+    }
+    return output.pos;
+}
+#endif
+
+/*
+ * Reads one line, or as much of it as fits, the way flex reads from a
+ * terminal, so the scanner sees each line as soon as it's typed.
+ */
+static size_t read_line(FILE* file, char* out, size_t size) {
+    size_t length = 0;
+    int c = EOF;
+    while (length < size && (c = getc(file)) != EOF) {
+        out[length++] = (char)c;
+        if (c == '\n') {
+            break;
+        }
+    }
+    if (c == EOF && ferror(file)) {
+        fail("can't read input");
+    }
+    return length;
+}
+
+/*
+ * Fills out with up to size bytes of decompressed input.  It only comes up
+ * short at the end of the input.
+ */
+static size_t decompress(struct compressed_input* input, char* out, size_t size) {
+    if (input->ended) {
+        return 0;
+    }
+
+    size_t length = 0;
+    switch (input->format) {
+    case FORMAT_TERMINAL:
+        return read_line(input->file, out, size);
+    case FORMAT_GZIP:
+        return inflate_gzip(input, out, size);
+#ifdef HAVE_ZSTD
+    case FORMAT_ZSTD:
+        return decompress_zstd(input, out, size);
+#endif
+    }
+
+    // Plain input: the bytes read to recognize the format come first
+    length = input->in_end - input->in_start;
+    if (length > size) {
+        length = size;
+    }
+    memcpy(out, input->in + input->in_start, length);
+    input->in_start += length;
+    length += fread(out + length, 1, size - length, input->file);
+    if (ferror(input->file)) {
+        fail("can't read input");
+    }
+    if (length < size) {
+        input->ended = 1;
+    }
+    return length;
+}
+
+/*
+ * Starts on a new input, reading its first bytes to see whether it's
+ * compressed.  Nothing is read from a terminal before the scanner asks for
+ * it, and nobody types compressed data anyway.
+ */
+static void open_input(struct compressed_input* input, FILE* file) {
+    input->file = file;
+    input->ended = 0;
+    input->in_start = input->in_end = 0;
+    input->format = FORMAT_PLAIN;
+    if (isatty(fileno(file))) {
+        input->format = FORMAT_TERMINAL;
+        return;
+    }
+
+    input->in_end = fread(input->in, 1, 4, file);
+    const unsigned char* magic = input->in;
+    if (input->in_end >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+        input->format = FORMAT_GZIP;
+        memset(&input->gzip, 0, sizeof(input->gzip));
+        if (inflateInit2(&input->gzip, 16 + MAX_WBITS) != Z_OK) {
+            fail("can't set up zlib");
+        }
+    } else if (input->in_end == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) {
+#ifdef HAVE_ZSTD
+        input->format = FORMAT_ZSTD;
+        input->zstd = ZSTD_createDStream();
+        input->zstd_status = 1;
+        if (!input->zstd) {
+            fail("can't set up zstd");
+        }
+#else
+        fail("zstd input needs compressed-input.c built with -DHAVE_ZSTD");
+#endif
+    }
+}
+
+#ifdef READAHEAD
+static void* read_ahead(void* arg) {
+    struct compressed_input* input = (struct compressed_input*)arg;
+    for (int block = 0;; block ^= 1) {
+        pthread_mutex_lock(&input->lock);
+        while (input->full[block] && !input->stop) {
+            pthread_cond_wait(&input->changed, &input->lock);
+        }
+        int stop = input->stop;
+        pthread_mutex_unlock(&input->lock);
+        if (stop) {
+            break;
+        }
+
+        size_t length = decompress(input, input->blocks[block], COMPRESSED_INPUT_BLOCK);
+
+        pthread_mutex_lock(&input->lock);
+        input->lengths[block] = length;
+        input->full[block] = 1;
+        pthread_cond_broadcast(&input->changed);
+        pthread_mutex_unlock(&input->lock);
+        if (length == 0) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void start_reading_ahead(struct compressed_input* input) {
+    input->stop = 0;
+    input->full[0] = input->full[1] = 0;
+    input->next = 0;
+    input->offset = 0;
+    pthread_mutex_init(&input->lock, NULL);
+    pthread_cond_init(&input->changed, NULL);
+    if (pthread_create(&input->thread, NULL, read_ahead, input) != 0) {
+        fail("can't start the readahead thread");
+    }
+    input->running = 1;
+}
+
+static void stop_reading_ahead(struct compressed_input* input) {
+    pthread_mutex_lock(&input->lock);
+    input->stop = 1;
+    pthread_cond_broadcast(&input->changed);
+    pthread_mutex_unlock(&input->lock);
+    pthread_join(input->thread, NULL);
+    pthread_cond_destroy(&input->changed);
+    pthread_mutex_destroy(&input->lock);
+    input->running = 0;
+}
+
+/*
+ * Copies what's left of the next block into buf, as much as fits.
+ */
+static size_t take_block(struct compressed_input* input, char* buf, size_t max_size) {
+    int block = input->next;
+    pthread_mutex_lock(&input->lock);
+    while (!input->full[block]) {
+        pthread_cond_wait(&input->changed, &input->lock);
+    }
+    size_t length = input->lengths[block];
+    pthread_mutex_unlock(&input->lock);
+
+    size_t count = length - input->offset;
+    if (count > max_size) {
+        count = max_size;
+    }
+    memcpy(buf, input->blocks[block] + input->offset, count);
+    input->offset += count;
+    if (input->offset == length) {
+        pthread_mutex_lock(&input->lock);
+        input->full[block] = 0;
+        pthread_cond_broadcast(&input->changed);
+        pthread_mutex_unlock(&input->lock);
+        input->next = block ^ 1;
+        input->offset = 0;
+    }
+    return count;
+}
+#endif
+
+size_t compressed_input_read(FILE* file, char* buf, size_t max_size) {
+    if (current.file != file) {
+        compressed_input_reset();
+        open_input(&current, file);
+#ifdef READAHEAD
+        if (current.format != FORMAT_TERMINAL) {
+            start_reading_ahead(&current);
+        }
+#endif
+    }
+
+#ifdef READAHEAD
+    if (current.running) {
+        size_t count = take_block(&current, buf, max_size);
+        if (count > 0) {
+            return count;
+        }
+        // The thread has reached the end of the input and stopped
+        stop_reading_ahead(&current);
+    }
+#endif
+    return decompress(&current, buf, max_size);
+}
+
+void compressed_input_reset(void) {
+    if (!current.file) {
+        return;
+    }
+#ifdef READAHEAD
+    if (current.running) {
+        stop_reading_ahead(&current);
+    }
+#endif
+    if (current.format == FORMAT_GZIP) {
+        inflateEnd(&current.gzip);
+    }
+#ifdef HAVE_ZSTD
+    if (current.format == FORMAT_ZSTD) {
+        ZSTD_freeDStream(current.zstd);
+    }
+#endif
+    current.file = NULL;
+}
@@ -0,0 +1,67 @@
+/*
+ * Compressed input for the flex scanners.
+ *
+ * counter.l and scanner.l can read gzip and zstd files as they are, without
+ * decompressing them to disk first.  Built with -DCOMPRESSED_INPUT, they
+ * replace flex's YY_INPUT with compressed_input_read(), which looks at the
+ * first bytes of the input to tell whether it's compressed, and decompresses
+ * straight into flex's buffer as the scanner asks for more.  Uncompressed
+ * input is passed through unchanged:
+ *
+ *   flex -o counter.c counter.l
+ *   gcc -DCOMPRESSED_INPUT counter.c compressed-input.c -lz -o counter
+ *   ./counter < corpus.txt.gz
+ *
+ *   flex -o scanner.c scanner.l
+ *   g++ -DCOMPRESSED_INPUT parser.c scanner.c ast.c bytecode.c parser-pratt.c compressed-input.c -lz -o parser
+ *   ./parser < source.py.gz
+ *
+ * gzip is always supported, through zlib.  zstd needs libzstd, and is only
+ * supported when compressed-input.c is built with -DHAVE_ZSTD (and linked
+ * with -lzstd).  Files made of several concatenated gzip members or zstd
+ * frames are read as one input, like gzip -d and zstd -d do.
+ *
+ * When compressed-input.c is also built with -DREADAHEAD (and -lpthread), a
+ * separate thread reads and decompresses the input in COMPRESSED_INPUT_BLOCK
+ * byte blocks.  It stays one block ahead of the scanner, so reading and
+ * decompressing the next block overlaps with scanning the current one.  That
+ * only pays off with a spare core; on a single core, handing blocks between
+ * the threads makes reading slightly slower instead.
+ *
+ * The input is read until it ends: a truncated or corrupt file stops the
+ * program with an error, instead of letting the scanner see part of it.
+ */
+
+#ifndef COMPRESSED_INPUT_H
+#define COMPRESSED_INPUT_H
+
+#include <stdio.h>
+
+#define COMPRESSED_INPUT_BLOCK (1 << 16)
+
+/*
+ * compressed-input.c is C, and scanner.l is C++, so the functions need C
+ * linkage either way.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Reads up to max_size bytes of decompressed input from file into buf, and
+ * returns how many it read, or 0 at the end of the input.  Like flex's own
+ * YY_INPUT, it reads a line at a time from a terminal.
+ */
+size_t compressed_input_read(FILE* file, char* buf, size_t max_size);
+
+/*
+ * Forgets the input being read, so the next call to compressed_input_read()
+ * starts on a new one.  Scanners call this when they are restarted.
+ */
+void compressed_input_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,389 @@
+/*
+ * Incremental compilation; see incremental.h.  Compiled regions are object
+ * files loaded into an ORC LLJIT instance.  A region's function is named
+ * after its fingerprint, so a region that shows up again (even somewhere
+ * else in the program) is only compiled and loaded once while it is cached.
+ * Each region's object file gets a resource tracker of its own, so its code
+ * can be freed again when the region is evicted.
+ */
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <llvm-c/Error.h>
+#include <llvm-c/LLJIT.h>
+#include <llvm-c/Target.h>
+#include <llvm-c/Transforms/PassBuilder.h>
+#include "incremental.h"
+
+#define MIN_REGION_STATEMENTS 4
+#define MAX_REGION_STATEMENTS 64
+#define MAX_CACHED_REGIONS 4096
+
+typedef int32_t (*region_function)(int32_t* vars);
+
+struct compiled_region {
+    region_function function;
+    LLVMOrcResourceTrackerRef tracker;   // Owns the region's code in the JIT
+    uint64_t last_used;                  // The last update that used it
+};
+
+struct incremental_compiler {
+    LLVMContextRef context;
+    LLVMTargetMachineRef machine;
+    LLVMOrcLLJITRef jit;
+    std::unordered_map<uint64_t, compiled_region> compiled;
+    std::vector<region_function> program;
+    uint64_t updates;
+
+    // Compiled code keeps its variables in slots rather than by symbol ID.
+    // A name gets a slot the first time any program uses it, and keeps it.
+    std::unordered_map<std::string, int32_t> slots;
+    std::vector<int32_t> symbol_slots;   // Slot of each of the program's symbols
+    std::vector<int32_t> slot_values;    // Where the program runs
+    std::vector<int32_t> pending;        // Nodes for the tree walks below
+};
+
+/*
+ * FNV-1a, fed one field at a time.
+ */
+struct fingerprint {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    void add(int32_t value) {
+        for (int i = 0; i < 4; i++) {
+            hash = (hash ^ ((uint32_t)value >> (8 * i) & 0xff)) * 0x100000001b3ULL;
+        }
+    }
+};
+
+/*
+ * Adds the expression at root to print, in prefix order.  Expressions can be
+ * nested too deeply to recurse (see ast_optimize()), so the operands wait on
+ * an explicit stack.
+ */
+static void add_expression(incremental_compiler* compiler, fingerprint& print, const ast& tree, int32_t root) {
+    std::vector<int32_t>& pending = compiler->pending;
+    pending.push_back(root);
+    while (!pending.empty()) {
+        int32_t node = pending.back();
+        pending.pop_back();
+        uint8_t op = tree.op[node];
+        print.add(op);
+        if (op == AST_INTEGER) {
+            print.add(tree.literal_values[tree.value[node]]);
+        } else if (op == AST_VARIABLE) {
+            print.add(compiler->symbol_slots[tree.value[node]]);
+        } else {
+            pending.push_back(tree.right[node]);
+            pending.push_back(tree.left[node]);
+        }
+    }
+}
+
+/*
+ * Generates the code for one region.  Variables live in vars, so every read
+ * is a load and every assignment a store; within the region, LLVM turns
+ * these into registers.  A node is only emitted once per region, like in
+ * ast-llvm.c.
+ */
+struct region_emitter {
+    const ast& tree;
+    const std::vector<int32_t>& symbol_slots;
+    std::vector<int32_t>& pending;
+    LLVMBuilderRef builder;
+    LLVMTypeRef int_type;
+    LLVMValueRef vars;
+    LLVMValueRef function;
+    LLVMBasicBlockRef division_by_zero;
+    std::unordered_map<int32_t, LLVMValueRef> values;
+};
+
+static LLVMValueRef variable_slot(region_emitter& emitter, int32_t symbol) {
+    LLVMValueRef index = LLVMConstInt(LLVMInt64TypeInContext(LLVMGetTypeContext(emitter.int_type)), emitter.symbol_slots[symbol], 0);
+    return LLVMBuildGEP2(emitter.builder, emitter.int_type, emitter.vars, &index, 1, "slot");
+}
+
+/*
+ * Division that behaves like the bytecode interpreter's: INT_MIN / -1 wraps
+ * around instead of trapping, and division by zero makes the region return 1.
+ */
+static LLVMValueRef emit_division(region_emitter& emitter, LLVMValueRef lhs, LLVMValueRef rhs) {
+    LLVMBuilderRef builder = emitter.builder;
+    LLVMContextRef context = LLVMGetTypeContext(emitter.int_type);
+    if (!emitter.division_by_zero) {
+        LLVMBasicBlockRef current = LLVMGetInsertBlock(builder);
+        emitter.division_by_zero = LLVMAppendBasicBlockInContext(context, emitter.function, "division_by_zero");
+        LLVMPositionBuilderAtEnd(builder, emitter.division_by_zero);
+        LLVMBuildRet(builder, LLVMConstInt(emitter.int_type, 1, 0));
+        LLVMPositionBuilderAtEnd(builder, current);
+    }
+
+    LLVMValueRef zero = LLVMConstInt(emitter.int_type, 0, 0);
+    LLVMValueRef minus_one = LLVMConstInt(emitter.int_type, (uint64_t)-1, 1);
+    LLVMBasicBlockRef divide = LLVMAppendBasicBlockInContext(context, emitter.function, "divide");
+    LLVMValueRef is_zero = LLVMBuildICmp(builder, LLVMIntEQ, rhs, zero, "is_zero");
+    LLVMBuildCondBr(builder, is_zero, emitter.division_by_zero, divide);
+    LLVMPositionBuilderAtEnd(builder, divide);
+
+    LLVMValueRef is_minus_one = LLVMBuildICmp(builder, LLVMIntEQ, rhs, minus_one, "is_minus_one");
+    LLVMValueRef divisor = LLVMBuildSelect(builder, is_minus_one, LLVMConstInt(emitter.int_type, 1, 0), rhs, "divisor");
+    LLVMValueRef quotient = LLVMBuildSDiv(builder, lhs, divisor, "quotient");
+    LLVMValueRef negated = LLVMBuildSub(builder, zero, lhs, "negated");
+    return LLVMBuildSelect(builder, is_minus_one, negated, quotient, "quotient");
+}
+
+/*
+ * Like add_expression(), this uses an explicit stack: a node waits on it
+ * until both of its operands are built, left first.
+ */
+static LLVMValueRef emit_expression(region_emitter& emitter, int32_t root) {
+    const ast& tree = emitter.tree;
+    std::vector<int32_t>& pending = emitter.pending;
+    pending.push_back(root);
+    while (!pending.empty()) {
+        int32_t node = pending.back();
+        if (emitter.values.count(node)) {
+            pending.pop_back();
+            continue;
+        }
+
+        uint8_t op = tree.op[node];
+        LLVMValueRef value;
+        if (op == AST_INTEGER) {
+            value = LLVMConstInt(emitter.int_type, (uint32_t)tree.literal_values[tree.value[node]], 1);
+        } else if (op == AST_VARIABLE) {
+            int32_t symbol = tree.value[node];
+            value = LLVMBuildLoad2(emitter.builder, emitter.int_type, variable_slot(emitter, symbol), tree.symbol_names[symbol].c_str());
+        } else {
+            auto lhs = emitter.values.find(tree.left[node]);
+            auto rhs = emitter.values.find(tree.right[node]);
+            if (lhs == emitter.values.end() || rhs == emitter.values.end()) {
+                if (rhs == emitter.values.end()) pending.push_back(tree.right[node]);
+                if (lhs == emitter.values.end()) pending.push_back(tree.left[node]);
+                continue;
+            }
+            switch (op) {
+            case AST_ADD: value = LLVMBuildAdd(emitter.builder, lhs->second, rhs->second, "sum"); break;
+            case AST_SUB: value = LLVMBuildSub(emitter.builder, lhs->second, rhs->second, "difference"); break;
+            case AST_MUL: value = LLVMBuildMul(emitter.builder, lhs->second, rhs->second, "product"); break;
+            default: value = emit_division(emitter, lhs->second, rhs->second); break;
+            }
+        }
+        emitter.values[node] = value;
+        pending.pop_back();
+    }
+    return emitter.values[root];
+}
+
+static std::string region_name(uint64_t print) {
+    char name[32];
+    snprintf(name, sizeof(name), "region_%016llx", (unsigned long long)print);
+    return name;
+}
+
+/*
+ * Frees a region's code.  Its function can't be called any more afterwards.
+ */
+static void release_region(compiled_region& region) {
+    LLVMErrorRef error = LLVMOrcResourceTrackerRemove(region.tracker);
+    if (error) {
+        LLVMConsumeError(error);
+    }
+    LLVMOrcReleaseResourceTracker(region.tracker);
+}
+
+/*
+ * Compiles statements [first, last) into an object file and loads it.
+ */
+static bool compile_region(incremental_compiler* compiler, const ast& tree, size_t first, size_t last, uint64_t print, compiled_region* region) {
+    std::string name = region_name(print);
+    LLVMContextRef context = compiler->context;
+    LLVMModuleRef module = LLVMModuleCreateWithNameInContext(name.c_str(), context);
+    char* triple = LLVMGetTargetMachineTriple(compiler->machine);
+    LLVMSetTarget(module, triple);
+    LLVMDisposeMessage(triple);
+    LLVMTargetDataRef data_layout = LLVMCreateTargetDataLayout(compiler->machine);
+    char* data_layout_string = LLVMCopyStringRepOfTargetData(data_layout);
+    LLVMSetDataLayout(module, data_layout_string);
+    LLVMDisposeMessage(data_layout_string);
+    LLVMDisposeTargetData(data_layout);
+
+    LLVMTypeRef int_type = LLVMInt32TypeInContext(context);
+    LLVMTypeRef vars_type = LLVMPointerType(int_type, 0);
+    LLVMTypeRef region_sig = LLVMFunctionType(int_type, &vars_type, 1, 0);
+    LLVMValueRef function = LLVMAddFunction(module, name.c_str(), region_sig);
+    LLVMBuilderRef builder = LLVMCreateBuilderInContext(context);
+    LLVMPositionBuilderAtEnd(builder, LLVMAppendBasicBlockInContext(context, function, "block"));
+
+    region_emitter emitter = { tree, compiler->symbol_slots, compiler->pending, builder, int_type, LLVMGetParam(function, 0), function, NULL, {} };
+    for (size_t s = first; s < last; s++) {
+        LLVMValueRef value = emit_expression(emitter, tree.stmt_value[s]);
+        LLVMBuildStore(builder, value, variable_slot(emitter, tree.stmt_target[s]));
+    }
+    LLVMBuildRet(builder, LLVMConstInt(int_type, 0, 0));
+    LLVMDisposeBuilder(builder);
+
+    LLVMPassBuilderOptionsRef options = LLVMCreatePassBuilderOptions();
+    LLVMErrorRef error = LLVMRunPasses(module, "default<O2>", compiler->machine, options);
+    LLVMDisposePassBuilderOptions(options);
+    if (error) {
+        LLVMConsumeError(error);
+    }
+
+    char* message = NULL;
+    LLVMMemoryBufferRef object = NULL;
+    bool emitted = !LLVMTargetMachineEmitToMemoryBuffer(compiler->machine, module, LLVMObjectFile, &message, &object);
+    LLVMDisposeModule(module);
+    if (!emitted) {
+        fprintf(stderr, "Error: %s\n", message);
+        LLVMDisposeMessage(message);
+        return false;
+    }
+
+    // The JIT takes ownership of the object.
+    LLVMOrcJITDylibRef dylib = LLVMOrcLLJITGetMainJITDylib(compiler->jit);
+    region->tracker = LLVMOrcJITDylibCreateResourceTracker(dylib);
+    error = LLVMOrcLLJITAddObjectFileWithRT(compiler->jit, region->tracker, object);
+    LLVMOrcExecutorAddress address = 0;
+    if (!error) {
+        error = LLVMOrcLLJITLookup(compiler->jit, &address, name.c_str());
+    }
+    if (error) {
+        char* error_message = LLVMGetErrorMessage(error);
+        fprintf(stderr, "Error: %s\n", error_message);
+        LLVMDisposeErrorMessage(error_message);
+        release_region(*region);
+        return false;
+    }
+    region->function = (region_function)address;
+    return true;
+}
+
+/*
+ * Once there are more than MAX_CACHED_REGIONS, drops the regions that have
+ * gone unused the longest until that many are left.  The current program's
+ * regions are never dropped, even if there are more of them.  Returns how
+ * many regions were dropped.
+ */
+static size_t evict_regions(incremental_compiler* compiler) {
+    if (compiler->compiled.size() <= MAX_CACHED_REGIONS) {
+        return 0;
+    }
+    std::vector<std::pair<uint64_t, uint64_t>> unused;   // Last use and fingerprint
+    for (const auto& entry : compiler->compiled) {
+        if (entry.second.last_used != compiler->updates) {
+            unused.emplace_back(entry.second.last_used, entry.first);
+        }
+    }
+    size_t evicted = std::min(compiler->compiled.size() - MAX_CACHED_REGIONS, unused.size());
+    std::nth_element(unused.begin(), unused.begin() + evicted, unused.end());
+    for (size_t i = 0; i < evicted; i++) {
+        auto found = compiler->compiled.find(unused[i].second);
+        release_region(found->second);
+        compiler->compiled.erase(found);
+    }
+    return evicted;
+}
+
+incremental_compiler* incremental_create(LLVMContextRef context, LLVMTargetMachineRef machine) {
+    LLVMInitializeNativeTarget();
+    LLVMInitializeNativeAsmPrinter();
+
+    LLVMOrcLLJITRef jit;
+    LLVMErrorRef error = LLVMOrcCreateLLJIT(&jit, NULL);
+    if (error) {
+        char* message = LLVMGetErrorMessage(error);
+        fprintf(stderr, "Error: %s\n", message);
+        LLVMDisposeErrorMessage(message);
+        return NULL;
+    }
+
+    incremental_compiler* compiler = new incremental_compiler;
+    compiler->context = context;
+    compiler->machine = machine;
+    compiler->jit = jit;
+    compiler->updates = 0;
+    return compiler;
+}
+
+bool incremental_update(incremental_compiler* compiler, const ast& tree, incremental_stats* stats) {
+    stats->regions = 0;
+    stats->compiled = 0;
+    stats->evicted = 0;
+    compiler->program.clear();
+    compiler->updates++;
+
+    compiler->symbol_slots.resize(tree.num_symbols());
+    for (size_t symbol = 0; symbol < tree.num_symbols(); symbol++) {
+        auto inserted = compiler->slots.emplace(tree.symbol_names[symbol], compiler->slots.size());
+        compiler->symbol_slots[symbol] = inserted.first->second;
+    }
+
+    size_t first = 0;
+    fingerprint region;
+    for (size_t s = 0; s < tree.num_statements(); s++) {
+        fingerprint statement;
+        statement.add(compiler->symbol_slots[tree.stmt_target[s]]);
+        add_expression(compiler, statement, tree, tree.stmt_value[s]);
+        region.add((int32_t)statement.hash);
+        region.add((int32_t)(statement.hash >> 32));
+
+        // A region ends after a statement whose hash ends in four zero bits,
+        // which happens every 16 statements on average.
+        size_t length = s + 1 - first;
+        bool boundary = (statement.hash & 15) == 0 && length >= MIN_REGION_STATEMENTS;
+        if (!boundary && length < MAX_REGION_STATEMENTS && s + 1 < tree.num_statements()) {
+            continue;
+        }
+
+        auto found = compiler->compiled.find(region.hash);
+        if (found == compiler->compiled.end()) {
+            compiled_region compiled;
+            if (!compile_region(compiler, tree, first, s + 1, region.hash, &compiled)) {
+                return false;
+            }
+            found = compiler->compiled.emplace(region.hash, compiled).first;
+            stats->compiled++;
+        }
+        found->second.last_used = compiler->updates;
+        compiler->program.push_back(found->second.function);
+        stats->regions++;
+        first = s + 1;
+        region = fingerprint();
+    }
+    stats->evicted = evict_regions(compiler);
+    return true;
+}
+
+bool incremental_run(incremental_compiler* compiler, int32_t* vars, size_t num_vars) {
+    // A variable that is read before it's assigned reads as 0.  The regions
+    // only touch the slots of the program's own variables.
+    std::vector<int32_t>& slot_values = compiler->slot_values;
+    slot_values.resize(compiler->slots.size());
+    for (int32_t slot : compiler->symbol_slots) {
+        slot_values[slot] = 0;
+    }
+    for (region_function function : compiler->program) {
+        if (function(slot_values.data()) != 0) {
+            return false;
+        }
+    }
+    for (size_t symbol = 0; symbol < num_vars; symbol++) {
+        vars[symbol] = slot_values[compiler->symbol_slots[symbol]];
+    }
+    return true;
+}
+
+void incremental_destroy(incremental_compiler* compiler) {
+    // The JIT frees all of the code itself; only our references to the
+    // trackers have to go first.
+    for (auto& entry : compiler->compiled) {
+        LLVMOrcReleaseResourceTracker(entry.second.tracker);
+    }
+    LLVMOrcDisposeLLJIT(compiler->jit);
+    delete compiler;
+}
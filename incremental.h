@@ -0,0 +1,74 @@
+/*
+ * Incremental compilation of parsed programs.
+ *
+ * Recompiling a whole program because one statement changed makes every edit
+ * cost as much as the program is big.  Instead, the program is split into
+ * regions of consecutive statements, and each region is compiled on its own
+ * into a function
+ *
+ *   int32_t region(int32_t* vars)
+ *
+ * that works directly on the program's variables in vars[slot].  Each
+ * region is identified by a fingerprint of its statements, and its compiled
+ * code is kept, so after an edit only the regions whose fingerprints changed
+ * are compiled again; the rest are reused as they are.
+ *
+ * A variable's slot comes from its name, not from its symbol ID, which
+ * depends on where the variable first appears in the program: the compiler
+ * gives each name a slot the first time it sees it and keeps it for every
+ * later update.  So adding or removing a variable doesn't move the others.
+ *
+ * The fingerprint is taken over the AST after ast_optimize(), with literal
+ * values and slots, so it covers a region's dependencies too: if an edit
+ * changes a constant that is propagated into a later region, that region's
+ * fingerprint changes as well.
+ *
+ * Region boundaries are picked from the statements' own hashes rather than
+ * by counting statements, so inserting or deleting a statement only moves
+ * the boundaries right around it.
+ *
+ * Every edit leaves the regions it replaced behind, so the cache is limited
+ * to a few thousand compiled regions.  When it grows past that, the regions
+ * that have gone unused for the most updates are evicted and their code is
+ * freed.
+ */
+
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <llvm-c/Core.h>
+#include <llvm-c/TargetMachine.h>
+#include "ast.h"
+
+struct incremental_compiler;
+
+struct incremental_stats {
+    size_t regions;    // Regions in the program
+    size_t compiled;   // Regions that had to be compiled
+    size_t evicted;    // Cached regions that were dropped afterwards
+};
+
+/*
+ * Creates a compiler that builds its regions in context and generates code
+ * with machine, which must be for the host.  Both must outlive it.
+ */
+incremental_compiler* incremental_create(LLVMContextRef context, LLVMTargetMachineRef machine);
+
+/*
+ * Makes tree the program that incremental_run() runs, compiling the regions
+ * that haven't been compiled before.  Returns false if code generation
+ * failed.
+ */
+bool incremental_update(incremental_compiler* compiler, const ast& tree, incremental_stats* stats);
+
+/*
+ * Runs the program, storing the final value of each variable into
+ * vars[symbol ID].  Returns false if the program divides by zero.
+ */
+bool incremental_run(incremental_compiler* compiler, int32_t* vars, size_t num_vars);
+
+void incremental_destroy(incremental_compiler* compiler);
+
+#endif
@@ -0,0 +1,111 @@
+/*
+ * Keyword recognition for the scanners.
+ *
+ * Instead of giving every keyword its own flex rule, which makes the DFA
+ * tables grow with every keyword we add, the scanners match all identifiers
+ * with one generic rule and then look the lexeme up here.  The lookup is a
+ * perfect hash over the keyword list: every keyword lands in its own slot, so
+ * a lookup is one hash, one length check and one memcmp.  The hash
+ * parameters are searched for by the compiler, so adding a keyword to the
+ * list is all it takes.
+ *
+ * Include this after parser.h, which defines the token values.
+ */
+
+#ifndef KEYWORDS_H
+#define KEYWORDS_H
+
+#include <cstring>
+
+struct keyword {
+    const char* name;
+    int token;
+};
+
+static constexpr keyword keywords[] = {
+    { "False", FALSE }, { "None", NONE }, { "True", TRUE },
+    { "and", AND }, { "as", AS }, { "assert", ASSERT },
+    { "async", ASYNC }, { "await", AWAIT }, { "break", BREAK },
+    { "class", CLASS }, { "continue", CONTINUE }, { "def", DEF },
+    { "del", DEL }, { "elif", ELIF }, { "else", ELSE },
+    { "except", EXCEPT }, { "finally", FINALLY }, { "for", FOR },
+    { "from", FROM }, { "global", GLOBAL }, { "if", IF },
+    { "import", IMPORT }, { "in", IN }, { "is", IS },
+    { "lambda", LAMBDA }, { "nonlocal", NONLOCAL }, { "not", NOT },
+    { "or", OR }, { "pass", PASS }, { "raise", RAISE },
+    { "return", RETURN }, { "try", TRY }, { "while", WHILE },
+    { "with", WITH }, { "yield", YIELD },
+};
+
+static constexpr int NUM_KEYWORDS = sizeof(keywords) / sizeof(keywords[0]);
+static constexpr unsigned KEYWORD_TABLE_SIZE = 128;
+
+constexpr int const_strlen(const char* s) {
+    int len = 0;
+    while (s[len]) {
+        len++;
+    }
+    return len;
+}
+
+/*
+ * The hash only looks at the first and last characters and the length, so
+ * it costs the same for every identifier no matter how long it is.
+ */
+constexpr unsigned keyword_hash(const char* s, int len, unsigned a, unsigned b) {
+    return ((unsigned char)s[0] * a + (unsigned char)s[len - 1] * b + len) & (KEYWORD_TABLE_SIZE - 1);
+}
+
+struct keyword_table {
+    unsigned a, b;
+    signed char slots[KEYWORD_TABLE_SIZE]; // Index into keywords[], or -1
+    unsigned char lengths[NUM_KEYWORDS];
+};
+
+/*
+ * Tries multipliers until every keyword hashes to a different slot.
+ */
+constexpr keyword_table build_keyword_table() {
+    for (unsigned a = 1; a < 256; a++) {
+        for (unsigned b = 1; b < 256; b++) {
+            keyword_table table = { a, b, {}, {} };
+            for (unsigned i = 0; i < KEYWORD_TABLE_SIZE; i++) {
+                table.slots[i] = -1;
+            }
+
+            bool collision = false;
+            for (int i = 0; i < NUM_KEYWORDS && !collision; i++) {
+                const char* name = keywords[i].name;
+                table.lengths[i] = const_strlen(name);
+                unsigned slot = keyword_hash(name, table.lengths[i], a, b);
+                collision = table.slots[slot] != -1;
+                table.slots[slot] = i;
+            }
+            if (!collision) {
+                return table;
+            }
+        }
+    }
+    return { 0, 0, {}, {} };
+}
+
+static constexpr keyword_table keyword_lookup_table = build_keyword_table();
+static_assert(keyword_lookup_table.a != 0,
+    "No perfect hash for the keyword list, make the table bigger or hash more characters");
+
+/*
+ * Returns the token for the keyword s[0..len), or 0 if s isn't a keyword.
+ */
+inline int keyword_token(const char* s, int len) {
+    const keyword_table& table = keyword_lookup_table;
+    int i = table.slots[keyword_hash(s, len, table.a, table.b)];
+    if (i < 0) {
+        return 0;
+    }
+    if (table.lengths[i] != len || memcmp(keywords[i].name, s, len) != 0) {
+        return 0;
+    }
+    return keywords[i].token;
+}
+
+#endif
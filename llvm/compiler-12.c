@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <llvm-c/Core.h>
+#include <llvm-c/Analysis.h>
+
+#include "hash.h"
+
+/*
+ * Values now carry either an integer or a floating point type.  We don't keep
+ * a separate type table for this: every LLVMValueRef already knows its type,
+ * so the "type" of an expression is just LLVMTypeOf() of the value we built
+ * for it, and the type of a variable is the allocated type of its alloca.
+ */
+int is_integer(LLVMValueRef value) {
+    return LLVMGetTypeKind(LLVMTypeOf(value)) == LLVMIntegerTypeKind;
+}
+
+/*
+ * The type two operands are brought to before they are combined.  Two
+ * integers stay integers (the wider of the two wins); as soon as one side is
+ * floating point, the result is floating point.
+ */
+LLVMTypeRef common_type(LLVMValueRef lhs, LLVMValueRef rhs) {
+    LLVMTypeRef lhs_type = LLVMTypeOf(lhs);
+    LLVMTypeRef rhs_type = LLVMTypeOf(rhs);
+    if (is_integer(lhs) && is_integer(rhs)) {
+        return LLVMGetIntTypeWidth(lhs_type) >= LLVMGetIntTypeWidth(rhs_type) ? lhs_type : rhs_type;
+    }
+    return is_integer(lhs) ? rhs_type : lhs_type;
+}
+
+/*
+ * Converts a value to the given type.  No instruction is emitted when the
+ * value already has that type, so conversions only show up where integer and
+ * floating point values actually mix.
+ */
+LLVMValueRef convert(LLVMValueRef value, LLVMTypeRef type, LLVMBuilderRef builder) {
+    LLVMTypeRef value_type = LLVMTypeOf(value);
+    if (value_type == type) {
+        return value;
+    }
+
+    int to_integer = LLVMGetTypeKind(type) == LLVMIntegerTypeKind;
+    if (is_integer(value) && to_integer) {
+        if (LLVMGetIntTypeWidth(value_type) < LLVMGetIntTypeWidth(type)) {
+            return LLVMBuildSExt(builder, value, type, "sext");
+        }
+        return LLVMBuildTrunc(builder, value, type, "trunc");
+    } else if (is_integer(value)) {
+        return LLVMBuildSIToFP(builder, value, type, "to_float");
+    } else if (to_integer) {
+        return LLVMBuildFPToSI(builder, value, type, "to_int");
+    }
+    return LLVMBuildFPCast(builder, value, type, "fpcast");
+}
+
+LLVMValueRef allocate_memory(const char* name, LLVMTypeRef type, LLVMBasicBlockRef block)
+{
+    LLVMBuilderRef tempBuilder = LLVMCreateBuilder();
+    LLVMValueRef first_instruction = LLVMGetFirstInstruction(block);
+
+    if (LLVMIsAInstruction(first_instruction)) {
+        LLVMPositionBuilderBefore(tempBuilder, first_instruction);
+    } else {
+        LLVMPositionBuilderAtEnd(tempBuilder, block);
+    }
+
+    LLVMValueRef alloca = LLVMBuildAlloca(tempBuilder, type, name);
+    LLVMDisposeBuilder(tempBuilder);
+    return alloca;
+}
+
+LLVMValueRef declare_variable(const char* name, LLVMTypeRef type, LLVMBuilderRef builder) {
+    LLVMBasicBlockRef function_entryBlock = LLVMGetEntryBasicBlock(LLVMGetBasicBlockParent(LLVMGetInsertBlock(builder)));
+    return allocate_memory(name, type, function_entryBlock);
+}
+
+/*
+ * A variable gets its type from the first value assigned to it.  Later
+ * assignments are converted to that type, the same way C treats an
+ * assignment to an already declared variable.
+ */
+LLVMValueRef assign(const char* name, LLVMValueRef value, struct hash* symbols, LLVMBuilderRef builder)
+{
+    LLVMValueRef mem_loc = NULL;
+    if (hash_contains(symbols, name)) {
+        mem_loc = hash_get(symbols, name);
+    } else {
+        mem_loc = declare_variable(name, LLVMTypeOf(value), builder);
+        hash_insert(symbols, name, mem_loc);
+    }
+    value = convert(value, LLVMGetAllocatedType(mem_loc), builder);
+    LLVMValueRef store = LLVMBuildStore(builder, value, mem_loc);
+    return mem_loc;
+}
+
+LLVMValueRef assign_and_get_variable(const char* name, LLVMValueRef value, struct hash* symbols, LLVMBuilderRef builder) {
+    LLVMValueRef lhs = assign(name, value, symbols, builder);
+    return LLVMBuildLoad2(builder, LLVMGetAllocatedType(lhs), lhs, name);
+}
+
+LLVMValueRef get_variable(const char* name, struct hash* symbols, LLVMBuilderRef builder) {
+    if (! hash_contains(symbols, name)) {
+        fprintf(stderr, "Error: Variable '%s' not found.\n", name); // Print an error message if the variable is not found
+        return LLVMGetUndef(LLVMInt32Type());
+    }
+    LLVMValueRef mem_loc = hash_get(symbols, name);
+    return LLVMBuildLoad2(builder, LLVMGetAllocatedType(mem_loc), mem_loc, name);
+}
+
+LLVMValueRef constant(float value) {
+    return  LLVMConstReal(LLVMFloatType(), value);
+}
+
+LLVMValueRef constant_int(long long value) {
+    if (value >= -2147483648LL && value <= 2147483647LL) {
+        return LLVMConstInt(LLVMInt32Type(), value, 1);
+    }
+    return LLVMConstInt(LLVMInt64Type(), value, 1);
+}
+
+LLVMValueRef less_than(LLVMValueRef lhs, LLVMValueRef rhs, LLVMBuilderRef builder) {
+    LLVMTypeRef type = common_type(lhs, rhs);
+    lhs = convert(lhs, type, builder);
+    rhs = convert(rhs, type, builder);
+    if (LLVMGetTypeKind(type) == LLVMIntegerTypeKind) {
+        return LLVMBuildICmp(builder, LLVMIntSLT, lhs, rhs, "less_than");
+    }
+    return LLVMBuildFCmp(builder, LLVMRealULT, lhs, rhs, "less_than");
+}
+
+LLVMValueRef arithmetic_operation(const char* operation, LLVMValueRef lhs, LLVMValueRef rhs, LLVMBuilderRef builder) {
+    LLVMTypeRef type = common_type(lhs, rhs);
+    lhs = convert(lhs, type, builder);
+    rhs = convert(rhs, type, builder);
+
+    if (LLVMGetTypeKind(type) == LLVMIntegerTypeKind) {
+        if (operation[0] == '+') {
+            return LLVMBuildAdd(builder, lhs, rhs, "sum");
+        } else if (operation[0] == '-') {
+            return LLVMBuildSub(builder, lhs, rhs, "difference");
+        } else if (operation[0] == '*') {
+            return LLVMBuildMul(builder, lhs, rhs, "product");
+        } else if (operation[0] == '/') {
+            return LLVMBuildSDiv(builder, lhs, rhs, "quotient");
+        }
+    } else {
+        if (operation[0] == '+') {
+            return LLVMBuildFAdd(builder, lhs, rhs, "sum");
+        } else if (operation[0] == '-') {
+            return LLVMBuildFSub(builder, lhs, rhs, "difference");
+        } else if (operation[0] == '*') {
+            return LLVMBuildFMul(builder, lhs, rhs, "product");
+        } else if (operation[0] == '/') {
+            return LLVMBuildFDiv(builder, lhs, rhs, "quotient");
+        }
+    }
+    return LLVMGetUndef(type);
+}
+
+LLVMValueRef build_if_else(struct hash* symbols, LLVMBuilderRef builder) {
+    LLVMValueRef variable_x = assign_and_get_variable("x", constant_int(3), symbols, builder);
+    LLVMValueRef variable_y = assign_and_get_variable("y", constant_int(5), symbols, builder);
+
+    LLVMValueRef condition = less_than(variable_x, constant_int(8), builder);
+    LLVMValueRef current_function = LLVMGetBasicBlockParent(LLVMGetInsertBlock(builder));
+
+    LLVMBasicBlockRef if_then_blk = LLVMAppendBasicBlock(current_function, "if.then");
+    LLVMBasicBlockRef if_else_blk = LLVMAppendBasicBlock(current_function, "if.else");
+    LLVMBasicBlockRef if_cont_blk = LLVMAppendBasicBlock(current_function, "if.continue");
+
+    LLVMBuildCondBr(builder, condition, if_then_blk, if_else_blk);
+
+    LLVMPositionBuilderAtEnd(builder, if_then_blk);
+    LLVMValueRef then_value = arithmetic_operation("*", variable_x, variable_y, builder);
+    assign("z", then_value, symbols, builder);
+    LLVMBuildBr(builder, if_cont_blk);
+
+    LLVMPositionBuilderAtEnd(builder, if_else_blk);
+    LLVMValueRef else_value = arithmetic_operation("+", variable_x, variable_y, builder);
+    assign("z", else_value, symbols, builder);
+    LLVMBuildBr(builder, if_cont_blk);
+
+    LLVMPositionBuilderAtEnd(builder, if_cont_blk);
+    return LLVMBasicBlockAsValue(if_cont_blk);
+}
+
+int main()
+{
+    /*
+        Generating IR code for the following C function.  x, y and z are
+        integers, so everything is computed with integer instructions; only
+        w mixes in a float, and only that one operation gets a conversion:
+        int arith_fn() {
+            int x = 3;
+            int y = 5;
+            int z;
+            if (x < 8) {
+                z = x * y;
+            } else {
+                z = x + y;
+            }
+            float w = z / 2.5;
+            return z;
+        }
+    */
+    struct hash* symbols = hash_create();
+
+    LLVMModuleRef module = LLVMModuleCreateWithName(
+        "lecture.code.12"
+    );
+
+    LLVMBuilderRef builder = LLVMCreateBuilder();
+
+    LLVMTypeRef return_type = LLVMInt32Type();
+    LLVMTypeRef arith_fn_sig = LLVMFunctionType(return_type,NULL,0,0);
+    LLVMValueRef arith_fn = LLVMAddFunction(module, "arith_fn", arith_fn_sig);
+    LLVMBasicBlockRef block = LLVMAppendBasicBlock(arith_fn, "block");
+    LLVMPositionBuilderAtEnd(builder, block);
+
+    build_if_else(symbols, builder);
+    LLVMValueRef variable_z = get_variable("z", symbols, builder);
+    assign("w", arithmetic_operation("/", variable_z, constant(2.5), builder), symbols, builder);
+    LLVMValueRef result = get_variable("z", symbols, builder);
+    LLVMBuildRet(builder, convert(result, return_type, builder));
+
+    LLVMVerifyModule(module, LLVMAbortProcessAction, NULL);
+
+    char* moduleString = LLVMPrintModuleToString(module);
+    printf("%s\n", moduleString);
+
+    LLVMDisposeBuilder(builder);
+    LLVMDisposeMessage(moduleString);
+    LLVMDisposeModule(module);
+    return 0;
+}
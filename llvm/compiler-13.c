@@ -0,0 +1,478 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <llvm-c/Core.h>
+#include <llvm-c/Analysis.h>
+#include <llvm-c/DebugInfo.h>
+#include <llvm-c/Target.h>
+#include <llvm-c/TargetMachine.h>
+#include <llvm-c/Transforms/PassBuilder.h>
+
+#include "hash.h"
+
+/*
+ * Values now carry either an integer or a floating point type.  We don't keep
+ * a separate type table for this: every LLVMValueRef already knows its type,
+ * so the "type" of an expression is just LLVMTypeOf() of the value we built
+ * for it, and the type of a variable is the allocated type of its alloca.
+ */
+int is_integer(LLVMValueRef value) {
+    return LLVMGetTypeKind(LLVMTypeOf(value)) == LLVMIntegerTypeKind;
+}
+
+/*
+ * The type two operands are brought to before they are combined.  Two
+ * integers stay integers (the wider of the two wins); as soon as one side is
+ * floating point, the result is floating point.
+ */
+LLVMTypeRef common_type(LLVMValueRef lhs, LLVMValueRef rhs) {
+    LLVMTypeRef lhs_type = LLVMTypeOf(lhs);
+    LLVMTypeRef rhs_type = LLVMTypeOf(rhs);
+    if (is_integer(lhs) && is_integer(rhs)) {
+        return LLVMGetIntTypeWidth(lhs_type) >= LLVMGetIntTypeWidth(rhs_type) ? lhs_type : rhs_type;
+    }
+    return is_integer(lhs) ? rhs_type : lhs_type;
+}
+
+/*
+ * Converts a value to the given type.  No instruction is emitted when the
+ * value already has that type, so conversions only show up where integer and
+ * floating point values actually mix.
+ */
+LLVMValueRef convert(LLVMValueRef value, LLVMTypeRef type, LLVMBuilderRef builder) {
+    LLVMTypeRef value_type = LLVMTypeOf(value);
+    if (value_type == type) {
+        return value;
+    }
+
+    int to_integer = LLVMGetTypeKind(type) == LLVMIntegerTypeKind;
+    if (is_integer(value) && to_integer) {
+        if (LLVMGetIntTypeWidth(value_type) < LLVMGetIntTypeWidth(type)) {
+            return LLVMBuildSExt(builder, value, type, "sext");
+        }
+        return LLVMBuildTrunc(builder, value, type, "trunc");
+    } else if (is_integer(value)) {
+        return LLVMBuildSIToFP(builder, value, type, "to_float");
+    } else if (to_integer) {
+        return LLVMBuildFPToSI(builder, value, type, "to_int");
+    }
+    return LLVMBuildFPCast(builder, value, type, "fpcast");
+}
+
+LLVMValueRef allocate_memory(const char* name, LLVMTypeRef type, LLVMBasicBlockRef block)
+{
+    LLVMBuilderRef tempBuilder = LLVMCreateBuilder();
+    LLVMValueRef first_instruction = LLVMGetFirstInstruction(block);
+
+    if (LLVMIsAInstruction(first_instruction)) {
+        LLVMPositionBuilderBefore(tempBuilder, first_instruction);
+    } else {
+        LLVMPositionBuilderAtEnd(tempBuilder, block);
+    }
+
+    LLVMValueRef alloca = LLVMBuildAlloca(tempBuilder, type, name);
+    LLVMDisposeBuilder(tempBuilder);
+    return alloca;
+}
+
+LLVMValueRef declare_variable(const char* name, LLVMTypeRef type, LLVMBuilderRef builder) {
+    LLVMBasicBlockRef function_entryBlock = LLVMGetEntryBasicBlock(LLVMGetBasicBlockParent(LLVMGetInsertBlock(builder)));
+    return allocate_memory(name, type, function_entryBlock);
+}
+
+/*
+ * A variable gets its type from the first value assigned to it.  Later
+ * assignments are converted to that type, the same way C treats an
+ * assignment to an already declared variable.
+ */
+LLVMValueRef assign(const char* name, LLVMValueRef value, struct hash* symbols, LLVMBuilderRef builder)
+{
+    LLVMValueRef mem_loc = NULL;
+    if (hash_contains(symbols, name)) {
+        mem_loc = hash_get(symbols, name);
+    } else {
+        mem_loc = declare_variable(name, LLVMTypeOf(value), builder);
+        hash_insert(symbols, name, mem_loc);
+    }
+    value = convert(value, LLVMGetAllocatedType(mem_loc), builder);
+    LLVMValueRef store = LLVMBuildStore(builder, value, mem_loc);
+    return mem_loc;
+}
+
+LLVMValueRef assign_and_get_variable(const char* name, LLVMValueRef value, struct hash* symbols, LLVMBuilderRef builder) {
+    LLVMValueRef lhs = assign(name, value, symbols, builder);
+    return LLVMBuildLoad2(builder, LLVMGetAllocatedType(lhs), lhs, name);
+}
+
+LLVMValueRef get_variable(const char* name, struct hash* symbols, LLVMBuilderRef builder) {
+    if (! hash_contains(symbols, name)) {
+        fprintf(stderr, "Error: Variable '%s' not found.\n", name); // Print an error message if the variable is not found
+        return LLVMGetUndef(LLVMInt32Type());
+    }
+    LLVMValueRef mem_loc = hash_get(symbols, name);
+    return LLVMBuildLoad2(builder, LLVMGetAllocatedType(mem_loc), mem_loc, name);
+}
+
+LLVMValueRef constant(float value) {
+    return  LLVMConstReal(LLVMFloatType(), value);
+}
+
+LLVMValueRef constant_int(long long value) {
+    if (value >= -2147483648LL && value <= 2147483647LL) {
+        return LLVMConstInt(LLVMInt32Type(), value, 1);
+    }
+    return LLVMConstInt(LLVMInt64Type(), value, 1);
+}
+
+LLVMValueRef less_than(LLVMValueRef lhs, LLVMValueRef rhs, LLVMBuilderRef builder) {
+    LLVMTypeRef type = common_type(lhs, rhs);
+    lhs = convert(lhs, type, builder);
+    rhs = convert(rhs, type, builder);
+    if (LLVMGetTypeKind(type) == LLVMIntegerTypeKind) {
+        return LLVMBuildICmp(builder, LLVMIntSLT, lhs, rhs, "less_than");
+    }
+    return LLVMBuildFCmp(builder, LLVMRealULT, lhs, rhs, "less_than");
+}
+
+LLVMValueRef arithmetic_operation(const char* operation, LLVMValueRef lhs, LLVMValueRef rhs, LLVMBuilderRef builder) {
+    LLVMTypeRef type = common_type(lhs, rhs);
+    lhs = convert(lhs, type, builder);
+    rhs = convert(rhs, type, builder);
+
+    if (LLVMGetTypeKind(type) == LLVMIntegerTypeKind) {
+        if (operation[0] == '+') {
+            return LLVMBuildAdd(builder, lhs, rhs, "sum");
+        } else if (operation[0] == '-') {
+            return LLVMBuildSub(builder, lhs, rhs, "difference");
+        } else if (operation[0] == '*') {
+            return LLVMBuildMul(builder, lhs, rhs, "product");
+        } else if (operation[0] == '/') {
+            return LLVMBuildSDiv(builder, lhs, rhs, "quotient");
+        }
+    } else {
+        if (operation[0] == '+') {
+            return LLVMBuildFAdd(builder, lhs, rhs, "sum");
+        } else if (operation[0] == '-') {
+            return LLVMBuildFSub(builder, lhs, rhs, "difference");
+        } else if (operation[0] == '*') {
+            return LLVMBuildFMul(builder, lhs, rhs, "product");
+        } else if (operation[0] == '/') {
+            return LLVMBuildFDiv(builder, lhs, rhs, "quotient");
+        }
+    }
+    return LLVMGetUndef(type);
+}
+
+LLVMValueRef build_if_else(struct hash* symbols, LLVMBuilderRef builder) {
+    LLVMValueRef variable_x = assign_and_get_variable("x", constant_int(3), symbols, builder);
+    LLVMValueRef variable_y = assign_and_get_variable("y", constant_int(5), symbols, builder);
+
+    LLVMValueRef condition = less_than(variable_x, constant_int(8), builder);
+    LLVMValueRef current_function = LLVMGetBasicBlockParent(LLVMGetInsertBlock(builder));
+
+    LLVMBasicBlockRef if_then_blk = LLVMAppendBasicBlock(current_function, "if.then");
+    LLVMBasicBlockRef if_else_blk = LLVMAppendBasicBlock(current_function, "if.else");
+    LLVMBasicBlockRef if_cont_blk = LLVMAppendBasicBlock(current_function, "if.continue");
+
+    LLVMBuildCondBr(builder, condition, if_then_blk, if_else_blk);
+
+    LLVMPositionBuilderAtEnd(builder, if_then_blk);
+    LLVMValueRef then_value = arithmetic_operation("*", variable_x, variable_y, builder);
+    assign("z", then_value, symbols, builder);
+    LLVMBuildBr(builder, if_cont_blk);
+
+    LLVMPositionBuilderAtEnd(builder, if_else_blk);
+    LLVMValueRef else_value = arithmetic_operation("+", variable_x, variable_y, builder);
+    assign("z", else_value, symbols, builder);
+    LLVMBuildBr(builder, if_cont_blk);
+
+    LLVMPositionBuilderAtEnd(builder, if_cont_blk);
+    return LLVMBasicBlockAsValue(if_cont_blk);
+}
+
+/*
+ * Loops are built in the canonical shape LLVM's loop passes look for:
+ *
+ *   preheader -> header -> body ... -> latch -> header
+ *                   \
+ *                    -> exit
+ *
+ * The preheader is whatever block the builder was in when the loop was
+ * started.  The header evaluates the loop condition, the body is emitted by
+ * the caller, and the latch is the single back edge, which is also where the
+ * llvm.loop metadata goes.
+ */
+struct loop {
+    LLVMBasicBlockRef preheader;
+    LLVMBasicBlockRef header;
+    LLVMBasicBlockRef body;
+    LLVMBasicBlockRef latch;
+    LLVMBasicBlockRef exit;
+    LLVMValueRef induction; // The induction variable phi (counted loops only)
+    LLVMValueRef step;
+};
+
+/*
+ * Optional hints passed on to the loop vectorizer and unroller.  A zero
+ * field means "leave it to LLVM's cost model".
+ */
+struct loop_hints {
+    int vectorize;       // 1 to request vectorization, -1 to disable it
+    int vectorize_width; // Vectorization factor to use
+    int unroll_count;    // Unroll factor to use, 1 disables unrolling
+};
+
+LLVMMetadataRef loop_property(const char* name, LLVMValueRef value) {
+    LLVMContextRef context = LLVMGetGlobalContext();
+    LLVMMetadataRef operands[2];
+    operands[0] = LLVMMDStringInContext2(context, name, strlen(name));
+    if (value == NULL) {
+        return LLVMMDNodeInContext2(context, operands, 1);
+    }
+    operands[1] = LLVMValueAsMetadata(value);
+    return LLVMMDNodeInContext2(context, operands, 2);
+}
+
+/*
+ * Attaches !llvm.loop metadata built from the hints to the latch branch.  The
+ * loop ID has to refer to itself as its first operand, so it's built around a
+ * temporary node that is then replaced by the finished node.
+ */
+void attach_loop_hints(LLVMValueRef latch_branch, struct loop_hints hints) {
+    LLVMContextRef context = LLVMGetGlobalContext();
+    LLVMMetadataRef operands[4];
+    size_t num_operands = 0;
+
+    LLVMMetadataRef placeholder = LLVMTemporaryMDNode(context, NULL, 0);
+    operands[num_operands++] = placeholder;
+
+    if (hints.vectorize != 0) {
+        LLVMValueRef enable = LLVMConstInt(LLVMInt1Type(), hints.vectorize > 0, 0);
+        operands[num_operands++] = loop_property("llvm.loop.vectorize.enable", enable);
+    }
+    if (hints.vectorize_width > 0) {
+        LLVMValueRef width = LLVMConstInt(LLVMInt32Type(), hints.vectorize_width, 0);
+        operands[num_operands++] = loop_property("llvm.loop.vectorize.width", width);
+    }
+    if (hints.unroll_count == 1) {
+        operands[num_operands++] = loop_property("llvm.loop.unroll.disable", NULL);
+    } else if (hints.unroll_count > 1) {
+        LLVMValueRef count = LLVMConstInt(LLVMInt32Type(), hints.unroll_count, 0);
+        operands[num_operands++] = loop_property("llvm.loop.unroll.count", count);
+    }
+
+    LLVMMetadataRef loop_id = LLVMMDNodeInContext2(context, operands, num_operands);
+    LLVMMetadataReplaceAllUsesWith(placeholder, loop_id);
+
+    unsigned kind = LLVMGetMDKindID("llvm.loop", strlen("llvm.loop"));
+    LLVMSetMetadata(latch_branch, kind, LLVMMetadataAsValue(context, loop_id));
+}
+
+struct loop append_loop_blocks(const char* name, LLVMBuilderRef builder) {
+    struct loop loop = {0};
+    char block_name[64];
+
+    loop.preheader = LLVMGetInsertBlock(builder);
+    LLVMValueRef current_function = LLVMGetBasicBlockParent(loop.preheader);
+
+    snprintf(block_name, sizeof(block_name), "%s.header", name);
+    loop.header = LLVMAppendBasicBlock(current_function, block_name);
+    snprintf(block_name, sizeof(block_name), "%s.body", name);
+    loop.body = LLVMAppendBasicBlock(current_function, block_name);
+    snprintf(block_name, sizeof(block_name), "%s.latch", name);
+    loop.latch = LLVMAppendBasicBlock(current_function, block_name);
+    snprintf(block_name, sizeof(block_name), "%s.exit", name);
+    loop.exit = LLVMAppendBasicBlock(current_function, block_name);
+
+    LLVMBuildBr(builder, loop.header);
+    LLVMPositionBuilderAtEnd(builder, loop.header);
+    return loop;
+}
+
+/*
+ * while loops are built in three steps:
+ *
+ *   struct loop loop = begin_while("while", builder);
+ *   ... build the condition (the builder is in the header) ...
+ *   while_condition(&loop, condition, builder);
+ *   ... build the body (the builder is in the body) ...
+ *   end_loop(&loop, hints, builder);
+ *
+ * after which the builder is positioned in the exit block.
+ */
+struct loop begin_while(const char* name, LLVMBuilderRef builder) {
+    return append_loop_blocks(name, builder);
+}
+
+void while_condition(struct loop* loop, LLVMValueRef condition, LLVMBuilderRef builder) {
+    LLVMBuildCondBr(builder, condition, loop->body, loop->exit);
+    LLVMPositionBuilderAtEnd(builder, loop->body);
+}
+
+/*
+ * Counted loops: for (i = start; i < end; i += step).  The induction
+ * variable lives in a phi in the header instead of in an alloca, so LLVM
+ * recognizes it without having to run mem2reg first.  The body is built
+ * between begin_for() and end_loop(), and can use loop.induction.
+ */
+struct loop begin_for(const char* name, LLVMValueRef start, LLVMValueRef end, LLVMValueRef step, LLVMBuilderRef builder) {
+    // The bounds are converted in the preheader, since the phi has to come
+    // first in the header.
+    LLVMTypeRef type = common_type(start, end);
+    start = convert(start, type, builder);
+    end = convert(end, type, builder);
+
+    struct loop loop = append_loop_blocks(name, builder);
+    loop.step = step;
+    loop.induction = LLVMBuildPhi(builder, type, name);
+
+    LLVMValueRef incoming_values[] = { start };
+    LLVMBasicBlockRef incoming_blocks[] = { loop.preheader };
+    LLVMAddIncoming(loop.induction, incoming_values, incoming_blocks, 1);
+
+    LLVMValueRef condition = less_than(loop.induction, end, builder);
+    while_condition(&loop, condition, builder);
+    return loop;
+}
+
+void end_loop(struct loop* loop, struct loop_hints hints, LLVMBuilderRef builder) {
+    LLVMBuildBr(builder, loop->latch);
+    LLVMPositionBuilderAtEnd(builder, loop->latch);
+
+    if (loop->induction) {
+        LLVMValueRef step = convert(loop->step, LLVMTypeOf(loop->induction), builder);
+        LLVMValueRef next = is_integer(step)
+            ? LLVMBuildNSWAdd(builder, loop->induction, step, "next")
+            : LLVMBuildFAdd(builder, loop->induction, step, "next");
+        LLVMValueRef incoming_values[] = { next };
+        LLVMBasicBlockRef incoming_blocks[] = { loop->latch };
+        LLVMAddIncoming(loop->induction, incoming_values, incoming_blocks, 1);
+    }
+
+    LLVMValueRef latch_branch = LLVMBuildBr(builder, loop->header);
+    attach_loop_hints(latch_branch, hints);
+    LLVMPositionBuilderAtEnd(builder, loop->exit);
+}
+
+/*
+ * Runs the standard -O3 pipeline (including the loop vectorizer and
+ * unroller) for the host machine over the module.
+ */
+void optimize_module(LLVMModuleRef module) {
+    LLVMInitializeNativeTarget();
+    LLVMInitializeNativeAsmPrinter();
+
+    char* triple = LLVMGetDefaultTargetTriple();
+    char* error = NULL;
+    LLVMTargetRef target = NULL;
+    if (LLVMGetTargetFromTriple(triple, &target, &error)) {
+        fprintf(stderr, "Error: %s\n", error);
+        LLVMDisposeMessage(error);
+        LLVMDisposeMessage(triple);
+        return;
+    }
+
+    char* cpu = LLVMGetHostCPUName();
+    char* features = LLVMGetHostCPUFeatures();
+    LLVMTargetMachineRef machine = LLVMCreateTargetMachine(
+        target, triple, cpu, features,
+        LLVMCodeGenLevelAggressive, LLVMRelocDefault, LLVMCodeModelDefault
+    );
+
+    LLVMSetTarget(module, triple);
+    LLVMTargetDataRef data_layout = LLVMCreateTargetDataLayout(machine);
+    char* data_layout_string = LLVMCopyStringRepOfTargetData(data_layout);
+    LLVMSetDataLayout(module, data_layout_string);
+
+    LLVMPassBuilderOptionsRef options = LLVMCreatePassBuilderOptions();
+    LLVMPassBuilderOptionsSetLoopVectorization(options, 1);
+    LLVMPassBuilderOptionsSetLoopUnrolling(options, 1);
+    LLVMErrorRef result = LLVMRunPasses(module, "default<O3>", machine, options);
+    if (result) {
+        char* message = LLVMGetErrorMessage(result);
+        fprintf(stderr, "Error: %s\n", message);
+        LLVMDisposeErrorMessage(message);
+    }
+
+    LLVMDisposePassBuilderOptions(options);
+    LLVMDisposeMessage(data_layout_string);
+    LLVMDisposeTargetData(data_layout);
+    LLVMDisposeTargetMachine(machine);
+    LLVMDisposeMessage(features);
+    LLVMDisposeMessage(cpu);
+    LLVMDisposeMessage(triple);
+}
+
+int main(int argc, char** argv)
+{
+    /*
+        Generating IR code for the following C function:
+        int arith_fn() {
+            int sum = 0;
+            for (int i = 0; i < 1000; i += 1) {  // vectorize, unroll by 4
+                sum = sum + i * 3;
+            }
+            int x = 1;
+            while (x < sum) {
+                x = x * 2;
+            }
+            return x;
+        }
+
+        Run with -O to also print the module after the optimization
+        pipeline has run on it.
+    */
+    struct hash* symbols = hash_create();
+
+    LLVMModuleRef module = LLVMModuleCreateWithName(
+        "lecture.code.13"
+    );
+
+    LLVMBuilderRef builder = LLVMCreateBuilder();
+
+    LLVMTypeRef return_type = LLVMInt32Type();
+    LLVMTypeRef arith_fn_sig = LLVMFunctionType(return_type,NULL,0,0);
+    LLVMValueRef arith_fn = LLVMAddFunction(module, "arith_fn", arith_fn_sig);
+    LLVMBasicBlockRef block = LLVMAppendBasicBlock(arith_fn, "block");
+    LLVMPositionBuilderAtEnd(builder, block);
+
+    assign("sum", constant_int(0), symbols, builder);
+
+    struct loop_hints for_hints = { 1, 0, 4 };
+    struct loop for_loop = begin_for("i", constant_int(0), constant_int(1000), constant_int(1), builder);
+    LLVMValueRef product = arithmetic_operation("*", for_loop.induction, constant_int(3), builder);
+    LLVMValueRef sum = get_variable("sum", symbols, builder);
+    assign("sum", arithmetic_operation("+", sum, product, builder), symbols, builder);
+    end_loop(&for_loop, for_hints, builder);
+
+    assign("x", constant_int(1), symbols, builder);
+
+    struct loop_hints while_hints = { 0, 0, 0 };
+    struct loop while_loop = begin_while("while", builder);
+    LLVMValueRef condition = less_than(get_variable("x", symbols, builder), get_variable("sum", symbols, builder), builder);
+    while_condition(&while_loop, condition, builder);
+    LLVMValueRef doubled = arithmetic_operation("*", get_variable("x", symbols, builder), constant_int(2), builder);
+    assign("x", doubled, symbols, builder);
+    end_loop(&while_loop, while_hints, builder);
+
+    LLVMValueRef result = get_variable("x", symbols, builder);
+    LLVMBuildRet(builder, convert(result, return_type, builder));
+
+    LLVMVerifyModule(module, LLVMAbortProcessAction, NULL);
+
+    char* moduleString = LLVMPrintModuleToString(module);
+    printf("%s\n", moduleString);
+    LLVMDisposeMessage(moduleString);
+
+    if (argc > 1 && strcmp(argv[1], "-O") == 0) {
+        optimize_module(module);
+        moduleString = LLVMPrintModuleToString(module);
+        printf("%s\n", moduleString);
+        LLVMDisposeMessage(moduleString);
+    }
+
+    LLVMDisposeBuilder(builder);
+    LLVMDisposeModule(module);
+    return 0;
+}
@@ -0,0 +1,608 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <llvm-c/Core.h>
+#include <llvm-c/Analysis.h>
+#include <llvm-c/DebugInfo.h>
+#include <llvm-c/Target.h>
+#include <llvm-c/TargetMachine.h>
+#include <llvm-c/Transforms/PassBuilder.h>
+
+#include "hash.h"
+
+/*
+ * Codegen modes.  While debugging, every value gets a readable name and every
+ * module is verified.  Both cost time on big programs: LLVM stores each name
+ * and has to make it unique (x1, y2, ...), and the verifier walks the whole
+ * module.  So release builds (-DNDEBUG) default to a lean mode that tells the
+ * context to throw names away and only verifies a sample of the modules.
+ */
+struct codegen_mode {
+    int discard_names;
+    int verify_interval;   // Verify every Nth module; 1 verifies them all
+};
+
+const struct codegen_mode debug_mode = { 0, 1 };
+const struct codegen_mode release_mode = { 1, 1000 };
+
+#ifdef NDEBUG
+struct codegen_mode current_mode = { 1, 1000 };
+#else
+struct codegen_mode current_mode = { 0, 1 };
+#endif
+
+/*
+ * Type handles used by the helpers, looked up once instead of on every call.
+ * The helpers use the global context, so these are its types.
+ */
+struct codegen_types {
+    LLVMTypeRef i1;
+    LLVMTypeRef i32;
+    LLVMTypeRef i64;
+    LLVMTypeRef float_type;
+};
+
+struct codegen_types types;
+
+/*
+ * allocate_memory() needs a second builder to put allocas in the entry
+ * block.  Creating one for every variable adds up, so one is kept around.
+ */
+LLVMBuilderRef entry_builder = NULL;
+
+void init_codegen(struct codegen_mode mode) {
+    current_mode = mode;
+    LLVMContextRef context = LLVMGetGlobalContext();
+    LLVMContextSetDiscardValueNames(context, mode.discard_names);
+
+    types.i1 = LLVMInt1TypeInContext(context);
+    types.i32 = LLVMInt32TypeInContext(context);
+    types.i64 = LLVMInt64TypeInContext(context);
+    types.float_type = LLVMFloatTypeInContext(context);
+    if (entry_builder == NULL) {
+        entry_builder = LLVMCreateBuilderInContext(context);
+    }
+}
+
+/*
+ * Called once a module is complete.  Aborts if the module turns out to be
+ * broken, like the earlier versions did after every build.
+ */
+void finish_module(LLVMModuleRef module) {
+    static unsigned long modules_built = 0;
+    if (current_mode.verify_interval > 0 && modules_built++ % current_mode.verify_interval == 0) {
+        LLVMVerifyModule(module, LLVMAbortProcessAction, NULL);
+    }
+}
+
+/*
+ * Values now carry either an integer or a floating point type.  We don't keep
+ * a separate type table for this: every LLVMValueRef already knows its type,
+ * so the "type" of an expression is just LLVMTypeOf() of the value we built
+ * for it, and the type of a variable is the allocated type of its alloca.
+ */
+int is_integer(LLVMValueRef value) {
+    return LLVMGetTypeKind(LLVMTypeOf(value)) == LLVMIntegerTypeKind;
+}
+
+/*
+ * The type two operands are brought to before they are combined.  Two
+ * integers stay integers (the wider of the two wins); as soon as one side is
+ * floating point, the result is floating point.
+ */
+LLVMTypeRef common_type(LLVMValueRef lhs, LLVMValueRef rhs) {
+    LLVMTypeRef lhs_type = LLVMTypeOf(lhs);
+    LLVMTypeRef rhs_type = LLVMTypeOf(rhs);
+    if (is_integer(lhs) && is_integer(rhs)) {
+        return LLVMGetIntTypeWidth(lhs_type) >= LLVMGetIntTypeWidth(rhs_type) ? lhs_type : rhs_type;
+    }
+    return is_integer(lhs) ? rhs_type : lhs_type;
+}
+
+/*
+ * Converts a value to the given type.  No instruction is emitted when the
+ * value already has that type, so conversions only show up where integer and
+ * floating point values actually mix.
+ */
+LLVMValueRef convert(LLVMValueRef value, LLVMTypeRef type, LLVMBuilderRef builder) {
+    LLVMTypeRef value_type = LLVMTypeOf(value);
+    if (value_type == type) {
+        return value;
+    }
+
+    int to_integer = LLVMGetTypeKind(type) == LLVMIntegerTypeKind;
+    if (is_integer(value) && to_integer) {
+        if (LLVMGetIntTypeWidth(value_type) < LLVMGetIntTypeWidth(type)) {
+            return LLVMBuildSExt(builder, value, type, "sext");
+        }
+        return LLVMBuildTrunc(builder, value, type, "trunc");
+    } else if (is_integer(value)) {
+        return LLVMBuildSIToFP(builder, value, type, "to_float");
+    } else if (to_integer) {
+        return LLVMBuildFPToSI(builder, value, type, "to_int");
+    }
+    return LLVMBuildFPCast(builder, value, type, "fpcast");
+}
+
+LLVMValueRef allocate_memory(const char* name, LLVMTypeRef type, LLVMBasicBlockRef block)
+{
+    LLVMValueRef first_instruction = LLVMGetFirstInstruction(block);
+
+    if (LLVMIsAInstruction(first_instruction)) {
+        LLVMPositionBuilderBefore(entry_builder, first_instruction);
+    } else {
+        LLVMPositionBuilderAtEnd(entry_builder, block);
+    }
+
+    return LLVMBuildAlloca(entry_builder, type, name);
+}
+
+LLVMValueRef declare_variable(const char* name, LLVMTypeRef type, LLVMBuilderRef builder) {
+    LLVMBasicBlockRef function_entryBlock = LLVMGetEntryBasicBlock(LLVMGetBasicBlockParent(LLVMGetInsertBlock(builder)));
+    return allocate_memory(name, type, function_entryBlock);
+}
+
+/*
+ * A variable gets its type from the first value assigned to it.  Later
+ * assignments are converted to that type, the same way C treats an
+ * assignment to an already declared variable.
+ */
+LLVMValueRef assign(const char* name, LLVMValueRef value, struct hash* symbols, LLVMBuilderRef builder)
+{
+    LLVMValueRef mem_loc = NULL;
+    if (hash_contains(symbols, name)) {
+        mem_loc = hash_get(symbols, name);
+    } else {
+        mem_loc = declare_variable(name, LLVMTypeOf(value), builder);
+        hash_insert(symbols, name, mem_loc);
+    }
+    value = convert(value, LLVMGetAllocatedType(mem_loc), builder);
+    LLVMValueRef store = LLVMBuildStore(builder, value, mem_loc);
+    return mem_loc;
+}
+
+LLVMValueRef assign_and_get_variable(const char* name, LLVMValueRef value, struct hash* symbols, LLVMBuilderRef builder) {
+    LLVMValueRef lhs = assign(name, value, symbols, builder);
+    return LLVMBuildLoad2(builder, LLVMGetAllocatedType(lhs), lhs, name);
+}
+
+LLVMValueRef get_variable(const char* name, struct hash* symbols, LLVMBuilderRef builder) {
+    if (! hash_contains(symbols, name)) {
+        fprintf(stderr, "Error: Variable '%s' not found.\n", name); // Print an error message if the variable is not found
+        return LLVMGetUndef(types.i32);
+    }
+    LLVMValueRef mem_loc = hash_get(symbols, name);
+    return LLVMBuildLoad2(builder, LLVMGetAllocatedType(mem_loc), mem_loc, name);
+}
+
+LLVMValueRef constant(float value) {
+    return  LLVMConstReal(types.float_type, value);
+}
+
+LLVMValueRef constant_int(long long value) {
+    if (value >= -2147483648LL && value <= 2147483647LL) {
+        return LLVMConstInt(types.i32, value, 1);
+    }
+    return LLVMConstInt(types.i64, value, 1);
+}
+
+LLVMValueRef less_than(LLVMValueRef lhs, LLVMValueRef rhs, LLVMBuilderRef builder) {
+    LLVMTypeRef type = common_type(lhs, rhs);
+    lhs = convert(lhs, type, builder);
+    rhs = convert(rhs, type, builder);
+    if (LLVMGetTypeKind(type) == LLVMIntegerTypeKind) {
+        return LLVMBuildICmp(builder, LLVMIntSLT, lhs, rhs, "less_than");
+    }
+    return LLVMBuildFCmp(builder, LLVMRealULT, lhs, rhs, "less_than");
+}
+
+LLVMValueRef arithmetic_operation(const char* operation, LLVMValueRef lhs, LLVMValueRef rhs, LLVMBuilderRef builder) {
+    LLVMTypeRef type = common_type(lhs, rhs);
+    lhs = convert(lhs, type, builder);
+    rhs = convert(rhs, type, builder);
+
+    if (LLVMGetTypeKind(type) == LLVMIntegerTypeKind) {
+        if (operation[0] == '+') {
+            return LLVMBuildAdd(builder, lhs, rhs, "sum");
+        } else if (operation[0] == '-') {
+            return LLVMBuildSub(builder, lhs, rhs, "difference");
+        } else if (operation[0] == '*') {
+            return LLVMBuildMul(builder, lhs, rhs, "product");
+        } else if (operation[0] == '/') {
+            return LLVMBuildSDiv(builder, lhs, rhs, "quotient");
+        }
+    } else {
+        if (operation[0] == '+') {
+            return LLVMBuildFAdd(builder, lhs, rhs, "sum");
+        } else if (operation[0] == '-') {
+            return LLVMBuildFSub(builder, lhs, rhs, "difference");
+        } else if (operation[0] == '*') {
+            return LLVMBuildFMul(builder, lhs, rhs, "product");
+        } else if (operation[0] == '/') {
+            return LLVMBuildFDiv(builder, lhs, rhs, "quotient");
+        }
+    }
+    return LLVMGetUndef(type);
+}
+
+LLVMValueRef build_if_else(struct hash* symbols, LLVMBuilderRef builder) {
+    LLVMValueRef variable_x = assign_and_get_variable("x", constant_int(3), symbols, builder);
+    LLVMValueRef variable_y = assign_and_get_variable("y", constant_int(5), symbols, builder);
+
+    LLVMValueRef condition = less_than(variable_x, constant_int(8), builder);
+    LLVMValueRef current_function = LLVMGetBasicBlockParent(LLVMGetInsertBlock(builder));
+
+    LLVMBasicBlockRef if_then_blk = LLVMAppendBasicBlock(current_function, "if.then");
+    LLVMBasicBlockRef if_else_blk = LLVMAppendBasicBlock(current_function, "if.else");
+    LLVMBasicBlockRef if_cont_blk = LLVMAppendBasicBlock(current_function, "if.continue");
+
+    LLVMBuildCondBr(builder, condition, if_then_blk, if_else_blk);
+
+    LLVMPositionBuilderAtEnd(builder, if_then_blk);
+    LLVMValueRef then_value = arithmetic_operation("*", variable_x, variable_y, builder);
+    assign("z", then_value, symbols, builder);
+    LLVMBuildBr(builder, if_cont_blk);
+
+    LLVMPositionBuilderAtEnd(builder, if_else_blk);
+    LLVMValueRef else_value = arithmetic_operation("+", variable_x, variable_y, builder);
+    assign("z", else_value, symbols, builder);
+    LLVMBuildBr(builder, if_cont_blk);
+
+    LLVMPositionBuilderAtEnd(builder, if_cont_blk);
+    return LLVMBasicBlockAsValue(if_cont_blk);
+}
+
+/*
+ * Loops are built in the canonical shape LLVM's loop passes look for:
+ *
+ *   preheader -> header -> body ... -> latch -> header
+ *                   \
+ *                    -> exit
+ *
+ * The preheader is whatever block the builder was in when the loop was
+ * started.  The header evaluates the loop condition, the body is emitted by
+ * the caller, and the latch is the single back edge, which is also where the
+ * llvm.loop metadata goes.
+ */
+struct loop {
+    LLVMBasicBlockRef preheader;
+    LLVMBasicBlockRef header;
+    LLVMBasicBlockRef body;
+    LLVMBasicBlockRef latch;
+    LLVMBasicBlockRef exit;
+    LLVMValueRef induction; // The induction variable phi (counted loops only)
+    LLVMValueRef step;
+};
+
+/*
+ * Optional hints passed on to the loop vectorizer and unroller.  A zero
+ * field means "leave it to LLVM's cost model".
+ */
+struct loop_hints {
+    int vectorize;       // 1 to request vectorization, -1 to disable it
+    int vectorize_width; // Vectorization factor to use
+    int unroll_count;    // Unroll factor to use, 1 disables unrolling
+};
+
+LLVMMetadataRef loop_property(const char* name, LLVMValueRef value) {
+    LLVMContextRef context = LLVMGetGlobalContext();
+    LLVMMetadataRef operands[2];
+    operands[0] = LLVMMDStringInContext2(context, name, strlen(name));
+    if (value == NULL) {
+        return LLVMMDNodeInContext2(context, operands, 1);
+    }
+    operands[1] = LLVMValueAsMetadata(value);
+    return LLVMMDNodeInContext2(context, operands, 2);
+}
+
+/*
+ * Attaches !llvm.loop metadata built from the hints to the latch branch.  The
+ * loop ID has to refer to itself as its first operand, so it's built around a
+ * temporary node that is then replaced by the finished node.
+ */
+void attach_loop_hints(LLVMValueRef latch_branch, struct loop_hints hints) {
+    LLVMContextRef context = LLVMGetGlobalContext();
+    LLVMMetadataRef operands[4];
+    size_t num_operands = 0;
+
+    LLVMMetadataRef placeholder = LLVMTemporaryMDNode(context, NULL, 0);
+    operands[num_operands++] = placeholder;
+
+    if (hints.vectorize != 0) {
+        LLVMValueRef enable = LLVMConstInt(types.i1, hints.vectorize > 0, 0);
+        operands[num_operands++] = loop_property("llvm.loop.vectorize.enable", enable);
+    }
+    if (hints.vectorize_width > 0) {
+        LLVMValueRef width = LLVMConstInt(types.i32, hints.vectorize_width, 0);
+        operands[num_operands++] = loop_property("llvm.loop.vectorize.width", width);
+    }
+    if (hints.unroll_count == 1) {
+        operands[num_operands++] = loop_property("llvm.loop.unroll.disable", NULL);
+    } else if (hints.unroll_count > 1) {
+        LLVMValueRef count = LLVMConstInt(types.i32, hints.unroll_count, 0);
+        operands[num_operands++] = loop_property("llvm.loop.unroll.count", count);
+    }
+
+    LLVMMetadataRef loop_id = LLVMMDNodeInContext2(context, operands, num_operands);
+    LLVMMetadataReplaceAllUsesWith(placeholder, loop_id);
+
+    unsigned kind = LLVMGetMDKindID("llvm.loop", strlen("llvm.loop"));
+    LLVMSetMetadata(latch_branch, kind, LLVMMetadataAsValue(context, loop_id));
+}
+
+/*
+ * Returns "<name>.<suffix>" in buffer, or "" if names are being discarded
+ * anyway, so we don't spend time formatting them.
+ */
+const char* block_name(char* buffer, size_t size, const char* name, const char* suffix) {
+    if (current_mode.discard_names) {
+        return "";
+    }
+    snprintf(buffer, size, "%s.%s", name, suffix);
+    return buffer;
+}
+
+struct loop append_loop_blocks(const char* name, LLVMBuilderRef builder) {
+    struct loop loop = {0};
+    char buffer[64];
+
+    loop.preheader = LLVMGetInsertBlock(builder);
+    LLVMValueRef current_function = LLVMGetBasicBlockParent(loop.preheader);
+
+    loop.header = LLVMAppendBasicBlock(current_function, block_name(buffer, sizeof(buffer), name, "header"));
+    loop.body = LLVMAppendBasicBlock(current_function, block_name(buffer, sizeof(buffer), name, "body"));
+    loop.latch = LLVMAppendBasicBlock(current_function, block_name(buffer, sizeof(buffer), name, "latch"));
+    loop.exit = LLVMAppendBasicBlock(current_function, block_name(buffer, sizeof(buffer), name, "exit"));
+
+    LLVMBuildBr(builder, loop.header);
+    LLVMPositionBuilderAtEnd(builder, loop.header);
+    return loop;
+}
+
+/*
+ * while loops are built in three steps:
+ *
+ *   struct loop loop = begin_while("while", builder);
+ *   ... build the condition (the builder is in the header) ...
+ *   while_condition(&loop, condition, builder);
+ *   ... build the body (the builder is in the body) ...
+ *   end_loop(&loop, hints, builder);
+ *
+ * after which the builder is positioned in the exit block.
+ */
+struct loop begin_while(const char* name, LLVMBuilderRef builder) {
+    return append_loop_blocks(name, builder);
+}
+
+void while_condition(struct loop* loop, LLVMValueRef condition, LLVMBuilderRef builder) {
+    LLVMBuildCondBr(builder, condition, loop->body, loop->exit);
+    LLVMPositionBuilderAtEnd(builder, loop->body);
+}
+
+/*
+ * Counted loops: for (i = start; i < end; i += step).  The induction
+ * variable lives in a phi in the header instead of in an alloca, so LLVM
+ * recognizes it without having to run mem2reg first.  The body is built
+ * between begin_for() and end_loop(), and can use loop.induction.
+ */
+struct loop begin_for(const char* name, LLVMValueRef start, LLVMValueRef end, LLVMValueRef step, LLVMBuilderRef builder) {
+    // The bounds are converted in the preheader, since the phi has to come
+    // first in the header.
+    LLVMTypeRef type = common_type(start, end);
+    start = convert(start, type, builder);
+    end = convert(end, type, builder);
+
+    struct loop loop = append_loop_blocks(name, builder);
+    loop.step = step;
+    loop.induction = LLVMBuildPhi(builder, type, name);
+
+    LLVMValueRef incoming_values[] = { start };
+    LLVMBasicBlockRef incoming_blocks[] = { loop.preheader };
+    LLVMAddIncoming(loop.induction, incoming_values, incoming_blocks, 1);
+
+    LLVMValueRef condition = less_than(loop.induction, end, builder);
+    while_condition(&loop, condition, builder);
+    return loop;
+}
+
+void end_loop(struct loop* loop, struct loop_hints hints, LLVMBuilderRef builder) {
+    LLVMBuildBr(builder, loop->latch);
+    LLVMPositionBuilderAtEnd(builder, loop->latch);
+
+    if (loop->induction) {
+        LLVMValueRef step = convert(loop->step, LLVMTypeOf(loop->induction), builder);
+        LLVMValueRef next = is_integer(step)
+            ? LLVMBuildNSWAdd(builder, loop->induction, step, "next")
+            : LLVMBuildFAdd(builder, loop->induction, step, "next");
+        LLVMValueRef incoming_values[] = { next };
+        LLVMBasicBlockRef incoming_blocks[] = { loop->latch };
+        LLVMAddIncoming(loop->induction, incoming_values, incoming_blocks, 1);
+    }
+
+    LLVMValueRef latch_branch = LLVMBuildBr(builder, loop->header);
+    attach_loop_hints(latch_branch, hints);
+    LLVMPositionBuilderAtEnd(builder, loop->exit);
+}
+
+/*
+ * Runs the standard -O3 pipeline (including the loop vectorizer and
+ * unroller) for the host machine over the module.
+ */
+void optimize_module(LLVMModuleRef module) {
+    LLVMInitializeNativeTarget();
+    LLVMInitializeNativeAsmPrinter();
+
+    char* triple = LLVMGetDefaultTargetTriple();
+    char* error = NULL;
+    LLVMTargetRef target = NULL;
+    if (LLVMGetTargetFromTriple(triple, &target, &error)) {
+        fprintf(stderr, "Error: %s\n", error);
+        LLVMDisposeMessage(error);
+        LLVMDisposeMessage(triple);
+        return;
+    }
+
+    char* cpu = LLVMGetHostCPUName();
+    char* features = LLVMGetHostCPUFeatures();
+    LLVMTargetMachineRef machine = LLVMCreateTargetMachine(
+        target, triple, cpu, features,
+        LLVMCodeGenLevelAggressive, LLVMRelocDefault, LLVMCodeModelDefault
+    );
+
+    LLVMSetTarget(module, triple);
+    LLVMTargetDataRef data_layout = LLVMCreateTargetDataLayout(machine);
+    char* data_layout_string = LLVMCopyStringRepOfTargetData(data_layout);
+    LLVMSetDataLayout(module, data_layout_string);
+
+    LLVMPassBuilderOptionsRef options = LLVMCreatePassBuilderOptions();
+    LLVMPassBuilderOptionsSetLoopVectorization(options, 1);
+    LLVMPassBuilderOptionsSetLoopUnrolling(options, 1);
+    LLVMErrorRef result = LLVMRunPasses(module, "default<O3>", machine, options);
+    if (result) {
+        char* message = LLVMGetErrorMessage(result);
+        fprintf(stderr, "Error: %s\n", message);
+        LLVMDisposeErrorMessage(message);
+    }
+
+    LLVMDisposePassBuilderOptions(options);
+    LLVMDisposeMessage(data_layout_string);
+    LLVMDisposeTargetData(data_layout);
+    LLVMDisposeTargetMachine(machine);
+    LLVMDisposeMessage(features);
+    LLVMDisposeMessage(cpu);
+    LLVMDisposeMessage(triple);
+}
+
+double seconds_since(struct timespec start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/*
+ * Builds a function of num_statements assignments like
+ *
+ *   v3 = v4 + v5 * 7
+ *
+ * over 16 variables, and returns how long building (and finishing) the
+ * module took.
+ */
+double time_ir_construction(struct codegen_mode mode, int num_statements) {
+    static const char* names[16] = {
+        "v0", "v1", "v2", "v3", "v4", "v5", "v6", "v7",
+        "v8", "v9", "v10", "v11", "v12", "v13", "v14", "v15"
+    };
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    init_codegen(mode);
+    struct hash* symbols = hash_create();
+    LLVMModuleRef module = LLVMModuleCreateWithName("lecture.code.14.benchmark");
+    LLVMBuilderRef builder = LLVMCreateBuilder();
+    LLVMTypeRef fn_sig = LLVMFunctionType(types.i32, NULL, 0, 0);
+    LLVMValueRef fn = LLVMAddFunction(module, "big_fn", fn_sig);
+    LLVMPositionBuilderAtEnd(builder, LLVMAppendBasicBlock(fn, "block"));
+
+    for (int i = 0; i < 16; i++) {
+        assign(names[i], constant_int(i), symbols, builder);
+    }
+    for (int i = 0; i < num_statements; i++) {
+        LLVMValueRef lhs = get_variable(names[(i + 1) % 16], symbols, builder);
+        LLVMValueRef rhs = get_variable(names[(i + 2) % 16], symbols, builder);
+        LLVMValueRef product = arithmetic_operation("*", rhs, constant_int(7), builder);
+        assign(names[i % 16], arithmetic_operation("+", lhs, product, builder), symbols, builder);
+    }
+    LLVMBuildRet(builder, get_variable("v0", symbols, builder));
+    finish_module(module);
+
+    double elapsed = seconds_since(start);
+    LLVMDisposeBuilder(builder);
+    LLVMDisposeModule(module);
+    return elapsed;
+}
+
+int main(int argc, char** argv)
+{
+    /*
+        Generating IR code for the following C function:
+        int arith_fn() {
+            int sum = 0;
+            for (int i = 0; i < 1000; i += 1) {  // vectorize, unroll by 4
+                sum = sum + i * 3;
+            }
+            int x = 1;
+            while (x < sum) {
+                x = x * 2;
+            }
+            return x;
+        }
+
+        Run with -O to also print the module after the optimization
+        pipeline has run on it.  Run with -b to compare how fast the two
+        codegen modes build a function of a million statements instead.
+    */
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+        int num_statements = 1000000;
+        double debug_time = time_ir_construction(debug_mode, num_statements);
+        double release_time = time_ir_construction(release_mode, num_statements);
+        printf("debug:   %.3f s (%.0f statements/s)\n", debug_time, num_statements / debug_time);
+        printf("release: %.3f s (%.0f statements/s)\n", release_time, num_statements / release_time);
+        return 0;
+    }
+
+    init_codegen(current_mode);
+    struct hash* symbols = hash_create();
+
+    LLVMModuleRef module = LLVMModuleCreateWithName(
+        "lecture.code.14"
+    );
+
+    LLVMBuilderRef builder = LLVMCreateBuilder();
+
+    LLVMTypeRef return_type = types.i32;
+    LLVMTypeRef arith_fn_sig = LLVMFunctionType(return_type,NULL,0,0);
+    LLVMValueRef arith_fn = LLVMAddFunction(module, "arith_fn", arith_fn_sig);
+    LLVMBasicBlockRef block = LLVMAppendBasicBlock(arith_fn, "block");
+    LLVMPositionBuilderAtEnd(builder, block);
+
+    assign("sum", constant_int(0), symbols, builder);
+
+    struct loop_hints for_hints = { 1, 0, 4 };
+    struct loop for_loop = begin_for("i", constant_int(0), constant_int(1000), constant_int(1), builder);
+    LLVMValueRef product = arithmetic_operation("*", for_loop.induction, constant_int(3), builder);
+    LLVMValueRef sum = get_variable("sum", symbols, builder);
+    assign("sum", arithmetic_operation("+", sum, product, builder), symbols, builder);
+    end_loop(&for_loop, for_hints, builder);
+
+    assign("x", constant_int(1), symbols, builder);
+
+    struct loop_hints while_hints = { 0, 0, 0 };
+    struct loop while_loop = begin_while("while", builder);
+    LLVMValueRef condition = less_than(get_variable("x", symbols, builder), get_variable("sum", symbols, builder), builder);
+    while_condition(&while_loop, condition, builder);
+    LLVMValueRef doubled = arithmetic_operation("*", get_variable("x", symbols, builder), constant_int(2), builder);
+    assign("x", doubled, symbols, builder);
+    end_loop(&while_loop, while_hints, builder);
+
+    LLVMValueRef result = get_variable("x", symbols, builder);
+    LLVMBuildRet(builder, convert(result, return_type, builder));
+
+    finish_module(module);
+
+    char* moduleString = LLVMPrintModuleToString(module);
+    printf("%s\n", moduleString);
+    LLVMDisposeMessage(moduleString);
+
+    if (argc > 1 && strcmp(argv[1], "-O") == 0) {
+        optimize_module(module);
+        moduleString = LLVMPrintModuleToString(module);
+        printf("%s\n", moduleString);
+        LLVMDisposeMessage(moduleString);
+    }
+
+    LLVMDisposeBuilder(builder);
+    LLVMDisposeModule(module);
+    return 0;
+}
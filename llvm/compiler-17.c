@@ -0,0 +1,1272 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <llvm-c/Core.h>
+#include <llvm-c/Analysis.h>
+#include <llvm-c/DebugInfo.h>
+#include <llvm-c/ExecutionEngine.h>
+#include <llvm-c/Target.h>
+#include <llvm-c/TargetMachine.h>
+#include <llvm-c/Transforms/PassBuilder.h>
+
+#include <llvm/Config/llvm-config.h>
+
+#include "hash.h"
+
+/*
+ * Codegen modes.  While debugging, every value gets a readable name and every
+ * module is verified.  Both cost time on big programs: LLVM stores each name
+ * and has to make it unique (x1, y2, ...), and the verifier walks the whole
+ * module.  So release builds (-DNDEBUG) default to a lean mode that tells the
+ * context to throw names away and only verifies a sample of the modules.
+ */
+struct codegen_mode {
+    int discard_names;
+    int verify_interval;   // Verify every Nth module; 1 verifies them all
+};
+
+const struct codegen_mode debug_mode = { 0, 1 };
+const struct codegen_mode release_mode = { 1, 1000 };
+
+#ifdef NDEBUG
+struct codegen_mode current_mode = { 1, 1000 };
+#else
+struct codegen_mode current_mode = { 0, 1 };
+#endif
+
+/*
+ * Type handles used by the helpers, looked up once instead of on every call.
+ * The helpers use the global context, so these are its types.
+ */
+struct codegen_types {
+    LLVMTypeRef i1;
+    LLVMTypeRef i32;
+    LLVMTypeRef i64;
+    LLVMTypeRef float_type;
+};
+
+struct codegen_types types;
+
+/*
+ * allocate_memory() needs a second builder to put allocas in the entry
+ * block.  Creating one for every variable adds up, so one is kept around.
+ */
+LLVMBuilderRef entry_builder = NULL;
+
+void init_codegen(struct codegen_mode mode) {
+    current_mode = mode;
+    LLVMContextRef context = LLVMGetGlobalContext();
+    LLVMContextSetDiscardValueNames(context, mode.discard_names);
+
+    types.i1 = LLVMInt1TypeInContext(context);
+    types.i32 = LLVMInt32TypeInContext(context);
+    types.i64 = LLVMInt64TypeInContext(context);
+    types.float_type = LLVMFloatTypeInContext(context);
+    if (entry_builder == NULL) {
+        entry_builder = LLVMCreateBuilderInContext(context);
+    }
+}
+
+/*
+ * Called once a module is complete.  Aborts if the module turns out to be
+ * broken, like the earlier versions did after every build.
+ */
+void finish_module(LLVMModuleRef module) {
+    static unsigned long modules_built = 0;
+    if (current_mode.verify_interval > 0 && modules_built++ % current_mode.verify_interval == 0) {
+        LLVMVerifyModule(module, LLVMAbortProcessAction, NULL);
+    }
+}
+
+/*
+ * Floating point precision policies.  By default, float instructions follow
+ * IEEE semantics exactly, which means LLVM may not reorder a sum, fuse a
+ * multiply and an add into an FMA, or vectorize a reduction, since any of
+ * those can change the result slightly.  A function can opt out:
+ *
+ *   FLOAT_STRICT     exact IEEE semantics (the default)
+ *   FLOAT_CONTRACT   a * b + c may become a fused multiply-add
+ *   FLOAT_FAST       anything goes: reassociation, reciprocals, and no NaNs,
+ *                    infinities or signed zeros are assumed
+ *
+ * The policy is set per function, with set_float_policy() right after the
+ * function is created, and applies to everything built until the next call.
+ * The matching fast-math flags go on every float instruction.  The C API
+ * only has LLVMSetFastMathFlags() since LLVM 18.  With older versions,
+ * fast-math-flags.cpp sets them through the C++ API instead (see README.md).
+ * Without it, the policy is only recorded in function attributes, which the
+ * code generator understands but most IR optimizations don't, so
+ * set_float_policy() warns about it.
+ */
+enum float_policy {
+    FLOAT_STRICT,
+    FLOAT_CONTRACT,
+    FLOAT_FAST
+};
+
+enum float_policy current_float_policy = FLOAT_STRICT;
+
+#if LLVM_VERSION_MAJOR < 18 && defined(FAST_MATH_SHIM)
+void set_fast_math_flags(LLVMValueRef instruction, int fast);
+#endif
+
+void add_function_attribute(LLVMValueRef function, const char* name, const char* value) {
+    LLVMAttributeRef attribute = LLVMCreateStringAttribute(
+        LLVMGetGlobalContext(), name, strlen(name), value, strlen(value)
+    );
+    LLVMAddAttributeAtIndex(function, LLVMAttributeFunctionIndex, attribute);
+}
+
+void set_float_policy(LLVMValueRef function, enum float_policy policy) {
+    current_float_policy = policy;
+#if LLVM_VERSION_MAJOR < 18 && !defined(FAST_MATH_SHIM)
+    static int warned = 0;
+    if (policy != FLOAT_STRICT && !warned) {
+        fprintf(stderr, "Warning: without fast-math-flags.cpp, LLVM %d can't put fast-math flags on "
+                        "instructions, so float policies only set function attributes\n", LLVM_VERSION_MAJOR);
+        warned = 1;
+    }
+#endif
+    if (policy == FLOAT_CONTRACT) {
+        add_function_attribute(function, "less-precise-fpmad", "true");
+    } else if (policy == FLOAT_FAST) {
+        add_function_attribute(function, "less-precise-fpmad", "true");
+        add_function_attribute(function, "unsafe-fp-math", "true");
+        add_function_attribute(function, "no-nans-fp-math", "true");
+        add_function_attribute(function, "no-infs-fp-math", "true");
+        add_function_attribute(function, "no-signed-zeros-fp-math", "true");
+        add_function_attribute(function, "approx-func-fp-math", "true");
+    }
+}
+
+/*
+ * Returns instruction, after adding the current policy's fast-math flags to
+ * it.
+ */
+LLVMValueRef apply_float_policy(LLVMValueRef instruction) {
+#if LLVM_VERSION_MAJOR >= 18
+    if (current_float_policy != FLOAT_STRICT && LLVMCanValueUseFastMathFlags(instruction)) {
+        LLVMFastMathFlags flags = current_float_policy == FLOAT_FAST
+            ? LLVMFastMathAll
+            : LLVMFastMathAllowContract;
+        LLVMSetFastMathFlags(instruction, flags);
+    }
+#elif defined(FAST_MATH_SHIM)
+    if (current_float_policy != FLOAT_STRICT) {
+        set_fast_math_flags(instruction, current_float_policy == FLOAT_FAST);
+    }
+#endif
+    return instruction;
+}
+
+/*
+ * Values now carry either an integer or a floating point type.  We don't keep
+ * a separate type table for this: every LLVMValueRef already knows its type,
+ * so the "type" of an expression is just LLVMTypeOf() of the value we built
+ * for it, and the type of a variable is the allocated type of its alloca.
+ */
+int is_integer(LLVMValueRef value) {
+    return LLVMGetTypeKind(LLVMTypeOf(value)) == LLVMIntegerTypeKind;
+}
+
+/*
+ * The type two operands are brought to before they are combined.  Two
+ * integers stay integers (the wider of the two wins); as soon as one side is
+ * floating point, the result is floating point.
+ */
+LLVMTypeRef common_type(LLVMValueRef lhs, LLVMValueRef rhs) {
+    LLVMTypeRef lhs_type = LLVMTypeOf(lhs);
+    LLVMTypeRef rhs_type = LLVMTypeOf(rhs);
+    if (is_integer(lhs) && is_integer(rhs)) {
+        return LLVMGetIntTypeWidth(lhs_type) >= LLVMGetIntTypeWidth(rhs_type) ? lhs_type : rhs_type;
+    }
+    return is_integer(lhs) ? rhs_type : lhs_type;
+}
+
+/*
+ * Converts a value to the given type.  No instruction is emitted when the
+ * value already has that type, so conversions only show up where integer and
+ * floating point values actually mix.
+ */
+LLVMValueRef convert(LLVMValueRef value, LLVMTypeRef type, LLVMBuilderRef builder) {
+    LLVMTypeRef value_type = LLVMTypeOf(value);
+    if (value_type == type) {
+        return value;
+    }
+
+    int to_integer = LLVMGetTypeKind(type) == LLVMIntegerTypeKind;
+    if (is_integer(value) && to_integer) {
+        if (LLVMGetIntTypeWidth(value_type) < LLVMGetIntTypeWidth(type)) {
+            return LLVMBuildSExt(builder, value, type, "sext");
+        }
+        return LLVMBuildTrunc(builder, value, type, "trunc");
+    } else if (is_integer(value)) {
+        return LLVMBuildSIToFP(builder, value, type, "to_float");
+    } else if (to_integer) {
+        return LLVMBuildFPToSI(builder, value, type, "to_int");
+    }
+    return LLVMBuildFPCast(builder, value, type, "fpcast");
+}
+
+LLVMValueRef allocate_memory(const char* name, LLVMTypeRef type, LLVMBasicBlockRef block)
+{
+    LLVMValueRef first_instruction = LLVMGetFirstInstruction(block);
+
+    if (LLVMIsAInstruction(first_instruction)) {
+        LLVMPositionBuilderBefore(entry_builder, first_instruction);
+    } else {
+        LLVMPositionBuilderAtEnd(entry_builder, block);
+    }
+
+    return LLVMBuildAlloca(entry_builder, type, name);
+}
+
+LLVMValueRef declare_variable(const char* name, LLVMTypeRef type, LLVMBuilderRef builder) {
+    LLVMBasicBlockRef function_entryBlock = LLVMGetEntryBasicBlock(LLVMGetBasicBlockParent(LLVMGetInsertBlock(builder)));
+    return allocate_memory(name, type, function_entryBlock);
+}
+
+/*
+ * A variable gets its type from the first value assigned to it.  Later
+ * assignments are converted to that type, the same way C treats an
+ * assignment to an already declared variable.
+ */
+LLVMValueRef assign(const char* name, LLVMValueRef value, struct hash* symbols, LLVMBuilderRef builder)
+{
+    LLVMValueRef mem_loc = NULL;
+    if (hash_contains(symbols, name)) {
+        mem_loc = hash_get(symbols, name);
+    } else {
+        mem_loc = declare_variable(name, LLVMTypeOf(value), builder);
+        hash_insert(symbols, name, mem_loc);
+    }
+    value = convert(value, LLVMGetAllocatedType(mem_loc), builder);
+    LLVMValueRef store = LLVMBuildStore(builder, value, mem_loc);
+    return mem_loc;
+}
+
+LLVMValueRef assign_and_get_variable(const char* name, LLVMValueRef value, struct hash* symbols, LLVMBuilderRef builder) {
+    LLVMValueRef lhs = assign(name, value, symbols, builder);
+    return LLVMBuildLoad2(builder, LLVMGetAllocatedType(lhs), lhs, name);
+}
+
+LLVMValueRef get_variable(const char* name, struct hash* symbols, LLVMBuilderRef builder) {
+    if (! hash_contains(symbols, name)) {
+        fprintf(stderr, "Error: Variable '%s' not found.\n", name); // Print an error message if the variable is not found
+        return LLVMGetUndef(types.i32);
+    }
+    LLVMValueRef mem_loc = hash_get(symbols, name);
+    return LLVMBuildLoad2(builder, LLVMGetAllocatedType(mem_loc), mem_loc, name);
+}
+
+LLVMValueRef constant(float value) {
+    return  LLVMConstReal(types.float_type, value);
+}
+
+LLVMValueRef constant_int(long long value) {
+    if (value >= -2147483648LL && value <= 2147483647LL) {
+        return LLVMConstInt(types.i32, value, 1);
+    }
+    return LLVMConstInt(types.i64, value, 1);
+}
+
+LLVMValueRef less_than(LLVMValueRef lhs, LLVMValueRef rhs, LLVMBuilderRef builder) {
+    LLVMTypeRef type = common_type(lhs, rhs);
+    lhs = convert(lhs, type, builder);
+    rhs = convert(rhs, type, builder);
+    if (LLVMGetTypeKind(type) == LLVMIntegerTypeKind) {
+        return LLVMBuildICmp(builder, LLVMIntSLT, lhs, rhs, "less_than");
+    }
+    return apply_float_policy(LLVMBuildFCmp(builder, LLVMRealULT, lhs, rhs, "less_than"));
+}
+
+LLVMValueRef arithmetic_operation(const char* operation, LLVMValueRef lhs, LLVMValueRef rhs, LLVMBuilderRef builder) {
+    LLVMTypeRef type = common_type(lhs, rhs);
+    lhs = convert(lhs, type, builder);
+    rhs = convert(rhs, type, builder);
+
+    if (LLVMGetTypeKind(type) == LLVMIntegerTypeKind) {
+        if (operation[0] == '+') {
+            return LLVMBuildAdd(builder, lhs, rhs, "sum");
+        } else if (operation[0] == '-') {
+            return LLVMBuildSub(builder, lhs, rhs, "difference");
+        } else if (operation[0] == '*') {
+            return LLVMBuildMul(builder, lhs, rhs, "product");
+        } else if (operation[0] == '/') {
+            return LLVMBuildSDiv(builder, lhs, rhs, "quotient");
+        }
+    } else {
+        if (operation[0] == '+') {
+            return apply_float_policy(LLVMBuildFAdd(builder, lhs, rhs, "sum"));
+        } else if (operation[0] == '-') {
+            return apply_float_policy(LLVMBuildFSub(builder, lhs, rhs, "difference"));
+        } else if (operation[0] == '*') {
+            return apply_float_policy(LLVMBuildFMul(builder, lhs, rhs, "product"));
+        } else if (operation[0] == '/') {
+            return apply_float_policy(LLVMBuildFDiv(builder, lhs, rhs, "quotient"));
+        }
+    }
+    return LLVMGetUndef(type);
+}
+
+/*
+ * Loads array[index], where array points to elements of the given type.
+ */
+LLVMValueRef get_element(LLVMValueRef array, LLVMValueRef index, LLVMTypeRef type, LLVMBuilderRef builder) {
+    LLVMValueRef address = LLVMBuildGEP2(builder, type, array, &index, 1, "address");
+    return LLVMBuildLoad2(builder, type, address, "element");
+}
+
+/*
+ * Profile-guided branch weights.  Compiling a program takes two builds:
+ *
+ *   1. With PROFILE_INSTRUMENT, every conditional branch also counts how
+ *      often it's reached and how often its condition is true.  The
+ *      instrumented program is run on typical inputs, and then
+ *      write_profile() saves the counts.
+ *
+ *   2. With PROFILE_USE, read_profile() loads the counts, and every
+ *      conditional branch gets !prof branch_weights metadata, so LLVM knows
+ *      which way it usually goes and lays out that side as the fall-through.
+ *
+ * A branch is identified by its function and by how many conditional
+ * branches were built in that function before it, so both builds have to
+ * build the same code in the same order.  The profile is a text file with a
+ * line per branch: "<function> <index> <true count> <false count>".
+ *
+ * Every function has to be passed to start_branch_numbering() right after
+ * it's added, before any of its branches are built.  Telling functions apart
+ * by their address doesn't work: once the training module is freed, the
+ * next build's function can get the address of the old one.
+ */
+enum profile_mode {
+    PROFILE_NONE,
+    PROFILE_INSTRUMENT,
+    PROFILE_USE
+};
+
+#define MAX_PROFILED_BRANCHES 1024
+
+struct branch_profile {
+    char function[64];
+    int index;
+    uint64_t true_count;
+    uint64_t false_count;
+    char counters[96];   // Name of the counter global (instrumented builds)
+};
+
+enum profile_mode profile_mode = PROFILE_NONE;
+struct branch_profile branch_profiles[MAX_PROFILED_BRANCHES];
+int num_branch_profiles = 0;
+
+LLVMValueRef profiled_function = NULL;
+int next_branch_index = 0;
+
+void start_branch_numbering(LLVMValueRef function) {
+    profiled_function = function;
+    next_branch_index = 0;
+}
+
+struct branch_profile* find_branch_profile(const char* function, int index) {
+    for (int i = 0; i < num_branch_profiles; i++) {
+        if (branch_profiles[i].index == index && strcmp(branch_profiles[i].function, function) == 0) {
+            return &branch_profiles[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Adds code that bumps the branch's counters: counters[0] is the number of
+ * times the condition was true, and counters[1] the number of times the
+ * branch was reached at all.
+ */
+void instrument_branch(const char* function, int index, LLVMValueRef condition, LLVMBuilderRef builder) {
+    if (num_branch_profiles == MAX_PROFILED_BRANCHES) {
+        fprintf(stderr, "Error: can't profile branch %d of %s, only %d branches can be profiled\n",
+                index, function, MAX_PROFILED_BRANCHES);
+        return;
+    }
+    struct branch_profile* profile = &branch_profiles[num_branch_profiles++];
+    snprintf(profile->function, sizeof(profile->function), "%s", function);
+    profile->index = index;
+    snprintf(profile->counters, sizeof(profile->counters), "__profile.%s.%d", function, index);
+
+    LLVMModuleRef module = LLVMGetGlobalParent(profiled_function);
+    LLVMTypeRef counters_type = LLVMArrayType(types.i64, 2);
+    LLVMValueRef counters = LLVMAddGlobal(module, counters_type, profile->counters);
+    LLVMSetInitializer(counters, LLVMConstNull(counters_type));
+
+    LLVMValueRef increments[] = { LLVMBuildZExt(builder, condition, types.i64, "taken"), LLVMConstInt(types.i64, 1, 0) };
+    for (int i = 0; i < 2; i++) {
+        LLVMValueRef indices[] = { constant_int(0), constant_int(i) };
+        LLVMValueRef counter = LLVMBuildGEP2(builder, counters_type, counters, indices, 2, "counter");
+        LLVMValueRef count = LLVMBuildLoad2(builder, types.i64, counter, "count");
+        LLVMBuildStore(builder, LLVMBuildAdd(builder, count, increments[i], "count"), counter);
+    }
+}
+
+void attach_branch_weights(LLVMValueRef branch, uint64_t true_count, uint64_t false_count) {
+    LLVMContextRef context = LLVMGetGlobalContext();
+    // Weights are 32 bits, so big counts are scaled down together.
+    while (true_count > UINT32_MAX - 1 || false_count > UINT32_MAX - 1) {
+        true_count /= 2;
+        false_count /= 2;
+    }
+    LLVMMetadataRef operands[] = {
+        LLVMMDStringInContext2(context, "branch_weights", strlen("branch_weights")),
+        LLVMValueAsMetadata(LLVMConstInt(types.i32, true_count + 1, 0)),
+        LLVMValueAsMetadata(LLVMConstInt(types.i32, false_count + 1, 0)),
+    };
+    LLVMMetadataRef weights = LLVMMDNodeInContext2(context, operands, 3);
+    unsigned kind = LLVMGetMDKindID("prof", strlen("prof"));
+    LLVMSetMetadata(branch, kind, LLVMMetadataAsValue(context, weights));
+}
+
+/*
+ * Builds a conditional branch, instrumented or weighted according to the
+ * profile mode.  All of the helpers build their conditional branches here.
+ */
+LLVMValueRef build_cond_br(LLVMValueRef condition, LLVMBasicBlockRef then_block, LLVMBasicBlockRef else_block, LLVMBuilderRef builder) {
+    LLVMValueRef function = LLVMGetBasicBlockParent(LLVMGetInsertBlock(builder));
+    if (function != profiled_function) {
+        fprintf(stderr, "Error: branch built in a function that wasn't passed to start_branch_numbering()\n");
+    }
+    int index = next_branch_index++;
+    size_t name_length;
+    const char* function_name = LLVMGetValueName2(function, &name_length);
+
+    if (profile_mode == PROFILE_INSTRUMENT) {
+        instrument_branch(function_name, index, condition, builder);
+    }
+    LLVMValueRef branch = LLVMBuildCondBr(builder, condition, then_block, else_block);
+    if (profile_mode == PROFILE_USE) {
+        struct branch_profile* profile = find_branch_profile(function_name, index);
+        if (profile) {
+            attach_branch_weights(branch, profile->true_count, profile->false_count);
+        }
+    }
+    return branch;
+}
+
+/*
+ * Reads the counters of an instrumented module that has been run in engine,
+ * and saves them.
+ */
+int write_profile(const char* path, LLVMExecutionEngineRef engine) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        perror(path);
+        return 0;
+    }
+    for (int i = 0; i < num_branch_profiles; i++) {
+        struct branch_profile* profile = &branch_profiles[i];
+        const uint64_t* counters = (const uint64_t*)LLVMGetGlobalValueAddress(engine, profile->counters);
+        if (counters) {
+            fprintf(file, "%s %d %llu %llu\n", profile->function, profile->index,
+                    (unsigned long long)counters[0], (unsigned long long)(counters[1] - counters[0]));
+        }
+    }
+    fclose(file);
+    return 1;
+}
+
+int read_profile(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        return 0;
+    }
+    num_branch_profiles = 0;
+    struct branch_profile profile = {0};
+    unsigned long long true_count, false_count;
+    while (fscanf(file, "%63s %d %llu %llu", profile.function, &profile.index, &true_count, &false_count) == 4) {
+        if (num_branch_profiles == MAX_PROFILED_BRANCHES) {
+            fprintf(stderr, "Error: %s has more than %d branches, ignoring the rest\n", path, MAX_PROFILED_BRANCHES);
+            break;
+        }
+        profile.true_count = true_count;
+        profile.false_count = false_count;
+        branch_profiles[num_branch_profiles++] = profile;
+    }
+    fclose(file);
+    return 1;
+}
+
+/*
+ * if/else statements are built like loops:
+ *
+ *   struct if_else if_else = begin_if(condition, builder);
+ *   ... build the then arm ...
+ *   begin_else(&if_else, builder);
+ *   ... build the else arm ...
+ *   end_if(&if_else, builder);
+ *
+ * after which the builder is positioned after the statement.
+ */
+struct if_else {
+    LLVMBasicBlockRef then_block;
+    LLVMBasicBlockRef else_block;
+    LLVMBasicBlockRef continue_block;
+};
+
+struct if_else begin_if(LLVMValueRef condition, LLVMBuilderRef builder) {
+    struct if_else if_else;
+    LLVMValueRef current_function = LLVMGetBasicBlockParent(LLVMGetInsertBlock(builder));
+    if_else.then_block = LLVMAppendBasicBlock(current_function, current_mode.discard_names ? "" : "if.then");
+    if_else.else_block = LLVMAppendBasicBlock(current_function, current_mode.discard_names ? "" : "if.else");
+    if_else.continue_block = LLVMAppendBasicBlock(current_function, current_mode.discard_names ? "" : "if.continue");
+    build_cond_br(condition, if_else.then_block, if_else.else_block, builder);
+    LLVMPositionBuilderAtEnd(builder, if_else.then_block);
+    return if_else;
+}
+
+void begin_else(struct if_else* if_else, LLVMBuilderRef builder) {
+    LLVMBuildBr(builder, if_else->continue_block);
+    LLVMPositionBuilderAtEnd(builder, if_else->else_block);
+}
+
+void end_if(struct if_else* if_else, LLVMBuilderRef builder) {
+    LLVMBuildBr(builder, if_else->continue_block);
+    LLVMPositionBuilderAtEnd(builder, if_else->continue_block);
+}
+
+/*
+ * Branchless if/else.  When both arms of an if/else only compute a value for
+ * the same variable, and that's cheap and can't fail, it's faster to compute
+ * both values and pick one with a select than to branch, at least when the
+ * condition is hard to predict.  So such an if/else is written as
+ *
+ *   LLVMValueRef then_start = arm_start(builder);
+ *   LLVMValueRef then_value = ... build the then value ...
+ *   LLVMValueRef else_start = arm_start(builder);
+ *   LLVMValueRef else_value = ... build the else value ...
+ *   assign_if_else("z", condition, then_start, then_value, else_start, else_value, symbols, builder);
+ *
+ * Both arms are built right away in the current block.  assign_if_else()
+ * then adds up their cost.  If it's at most select_cost_threshold, and
+ * nothing in them has side effects or can trap, the arms stay where they are
+ * and the variable is assigned a select.  Otherwise the arms are moved into
+ * the blocks of a regular if/else.  A threshold of 0 always branches.
+ */
+int select_cost_threshold = 4;
+
+LLVMValueRef arm_start(LLVMBuilderRef builder) {
+    return LLVMGetLastInstruction(LLVMGetInsertBlock(builder));
+}
+
+LLVMValueRef first_after(LLVMValueRef start, LLVMBasicBlockRef block) {
+    return start ? LLVMGetNextInstruction(start) : LLVMGetFirstInstruction(block);
+}
+
+/*
+ * What it costs to run an instruction even when its result isn't needed, or
+ * -1 if it may not be run that way.  Loads are only safe from our variables'
+ * allocas, which are always there.  Integer division can trap.
+ */
+int speculation_cost(LLVMValueRef instruction) {
+    switch (LLVMGetInstructionOpcode(instruction)) {
+    case LLVMAdd:
+    case LLVMSub:
+    case LLVMMul:
+    case LLVMFAdd:
+    case LLVMFSub:
+    case LLVMFMul:
+    case LLVMICmp:
+    case LLVMFCmp:
+    case LLVMSExt:
+    case LLVMZExt:
+    case LLVMTrunc:
+    case LLVMSIToFP:
+    case LLVMFPToSI:
+    case LLVMFPExt:
+    case LLVMFPTrunc:
+    case LLVMSelect:
+        return 1;
+    case LLVMFDiv:
+        return 4;
+    case LLVMLoad:
+        return LLVMIsAAllocaInst(LLVMGetOperand(instruction, 0)) ? 1 : -1;
+    default:
+        return -1;
+    }
+}
+
+/*
+ * The cost of the instructions from first up to (not including) end, or -1
+ * if any of them can't be speculated.
+ */
+int arm_cost(LLVMValueRef first, LLVMValueRef end) {
+    int cost = 0;
+    for (LLVMValueRef instruction = first; instruction != end; instruction = LLVMGetNextInstruction(instruction)) {
+        int instruction_cost = speculation_cost(instruction);
+        if (instruction_cost < 0) {
+            return -1;
+        }
+        cost += instruction_cost;
+    }
+    return cost;
+}
+
+/*
+ * Moves the instructions from first up to (not including) end to where the
+ * builder is.
+ */
+void move_arm(LLVMValueRef first, LLVMValueRef end, LLVMBuilderRef builder) {
+    LLVMValueRef instruction = first;
+    while (instruction != end) {
+        LLVMValueRef next = LLVMGetNextInstruction(instruction);
+        size_t length;
+        const char* name = LLVMGetValueName2(instruction, &length);
+        char saved_name[64];
+        snprintf(saved_name, sizeof(saved_name), "%.*s", (int)length, name);
+        LLVMInstructionRemoveFromParent(instruction);
+        LLVMInsertIntoBuilderWithName(builder, instruction, saved_name);
+        instruction = next;
+    }
+}
+
+void assign_if_else(const char* name, LLVMValueRef condition,
+                    LLVMValueRef then_start, LLVMValueRef then_value,
+                    LLVMValueRef else_start, LLVMValueRef else_value,
+                    struct hash* symbols, LLVMBuilderRef builder) {
+    LLVMBasicBlockRef block = LLVMGetInsertBlock(builder);
+    LLVMValueRef then_first = first_after(then_start, block);
+    LLVMValueRef else_first = first_after(else_start, block);
+    int then_cost = arm_cost(then_first, else_first);
+    int else_cost = arm_cost(else_first, NULL);
+
+    if (then_cost >= 0 && else_cost >= 0 && then_cost + else_cost <= select_cost_threshold) {
+        LLVMTypeRef type = common_type(then_value, else_value);
+        then_value = convert(then_value, type, builder);
+        else_value = convert(else_value, type, builder);
+        assign(name, LLVMBuildSelect(builder, condition, then_value, else_value, "select"), symbols, builder);
+        return;
+    }
+
+    // The branch (and its profiling counter, if any) goes after the arms for
+    // now, and then they're moved out.  An arm that built nothing starts
+    // where the next one does, or where the branch does, so the arms are
+    // only found once the branch is there.
+    LLVMValueRef arms_end = LLVMGetLastInstruction(block);
+    struct if_else if_else = begin_if(condition, builder);
+    LLVMValueRef branch_first = first_after(arms_end, block);
+    then_first = first_after(then_start, block);
+    else_first = first_after(else_start, block);
+    move_arm(then_first, else_first, builder);
+    assign(name, then_value, symbols, builder);
+    begin_else(&if_else, builder);
+    move_arm(else_first, branch_first, builder);
+    assign(name, else_value, symbols, builder);
+    end_if(&if_else, builder);
+}
+
+LLVMValueRef build_if_else(struct hash* symbols, LLVMBuilderRef builder) {
+    LLVMValueRef variable_x = assign_and_get_variable("x", constant_int(3), symbols, builder);
+    LLVMValueRef variable_y = assign_and_get_variable("y", constant_int(5), symbols, builder);
+
+    LLVMValueRef condition = less_than(variable_x, constant_int(8), builder);
+
+    LLVMValueRef then_start = arm_start(builder);
+    LLVMValueRef then_value = arithmetic_operation("*", variable_x, variable_y, builder);
+    LLVMValueRef else_start = arm_start(builder);
+    LLVMValueRef else_value = arithmetic_operation("+", variable_x, variable_y, builder);
+    assign_if_else("z", condition, then_start, then_value, else_start, else_value, symbols, builder);
+
+    return LLVMBasicBlockAsValue(LLVMGetInsertBlock(builder));
+}
+
+/*
+ * Loops are built in the canonical shape LLVM's loop passes look for:
+ *
+ *   preheader -> header -> body ... -> latch -> header
+ *                   \
+ *                    -> exit
+ *
+ * The preheader is whatever block the builder was in when the loop was
+ * started.  The header evaluates the loop condition, the body is emitted by
+ * the caller, and the latch is the single back edge, which is also where the
+ * llvm.loop metadata goes.
+ */
+struct loop {
+    LLVMBasicBlockRef preheader;
+    LLVMBasicBlockRef header;
+    LLVMBasicBlockRef body;
+    LLVMBasicBlockRef latch;
+    LLVMBasicBlockRef exit;
+    LLVMValueRef induction; // The induction variable phi (counted loops only)
+    LLVMValueRef step;
+};
+
+/*
+ * Optional hints passed on to the loop vectorizer and unroller.  A zero
+ * field means "leave it to LLVM's cost model".
+ */
+struct loop_hints {
+    int vectorize;       // 1 to request vectorization, -1 to disable it
+    int vectorize_width; // Vectorization factor to use
+    int unroll_count;    // Unroll factor to use, 1 disables unrolling
+};
+
+LLVMMetadataRef loop_property(const char* name, LLVMValueRef value) {
+    LLVMContextRef context = LLVMGetGlobalContext();
+    LLVMMetadataRef operands[2];
+    operands[0] = LLVMMDStringInContext2(context, name, strlen(name));
+    if (value == NULL) {
+        return LLVMMDNodeInContext2(context, operands, 1);
+    }
+    operands[1] = LLVMValueAsMetadata(value);
+    return LLVMMDNodeInContext2(context, operands, 2);
+}
+
+/*
+ * Attaches !llvm.loop metadata built from the hints to the latch branch.  The
+ * loop ID has to refer to itself as its first operand, so it's built around a
+ * temporary node that is then replaced by the finished node.
+ */
+void attach_loop_hints(LLVMValueRef latch_branch, struct loop_hints hints) {
+    LLVMContextRef context = LLVMGetGlobalContext();
+    LLVMMetadataRef operands[4];
+    size_t num_operands = 0;
+
+    LLVMMetadataRef placeholder = LLVMTemporaryMDNode(context, NULL, 0);
+    operands[num_operands++] = placeholder;
+
+    if (hints.vectorize != 0) {
+        LLVMValueRef enable = LLVMConstInt(types.i1, hints.vectorize > 0, 0);
+        operands[num_operands++] = loop_property("llvm.loop.vectorize.enable", enable);
+    }
+    if (hints.vectorize_width > 0) {
+        LLVMValueRef width = LLVMConstInt(types.i32, hints.vectorize_width, 0);
+        operands[num_operands++] = loop_property("llvm.loop.vectorize.width", width);
+    }
+    if (hints.unroll_count == 1) {
+        operands[num_operands++] = loop_property("llvm.loop.unroll.disable", NULL);
+    } else if (hints.unroll_count > 1) {
+        LLVMValueRef count = LLVMConstInt(types.i32, hints.unroll_count, 0);
+        operands[num_operands++] = loop_property("llvm.loop.unroll.count", count);
+    }
+
+    LLVMMetadataRef loop_id = LLVMMDNodeInContext2(context, operands, num_operands);
+    LLVMMetadataReplaceAllUsesWith(placeholder, loop_id);
+
+    unsigned kind = LLVMGetMDKindID("llvm.loop", strlen("llvm.loop"));
+    LLVMSetMetadata(latch_branch, kind, LLVMMetadataAsValue(context, loop_id));
+}
+
+/*
+ * Returns "<name>.<suffix>" in buffer, or "" if names are being discarded
+ * anyway, so we don't spend time formatting them.
+ */
+const char* block_name(char* buffer, size_t size, const char* name, const char* suffix) {
+    if (current_mode.discard_names) {
+        return "";
+    }
+    snprintf(buffer, size, "%s.%s", name, suffix);
+    return buffer;
+}
+
+struct loop append_loop_blocks(const char* name, LLVMBuilderRef builder) {
+    struct loop loop = {0};
+    char buffer[64];
+
+    loop.preheader = LLVMGetInsertBlock(builder);
+    LLVMValueRef current_function = LLVMGetBasicBlockParent(loop.preheader);
+
+    loop.header = LLVMAppendBasicBlock(current_function, block_name(buffer, sizeof(buffer), name, "header"));
+    loop.body = LLVMAppendBasicBlock(current_function, block_name(buffer, sizeof(buffer), name, "body"));
+    loop.latch = LLVMAppendBasicBlock(current_function, block_name(buffer, sizeof(buffer), name, "latch"));
+    loop.exit = LLVMAppendBasicBlock(current_function, block_name(buffer, sizeof(buffer), name, "exit"));
+
+    LLVMBuildBr(builder, loop.header);
+    LLVMPositionBuilderAtEnd(builder, loop.header);
+    return loop;
+}
+
+/*
+ * while loops are built in three steps:
+ *
+ *   struct loop loop = begin_while("while", builder);
+ *   ... build the condition (the builder is in the header) ...
+ *   while_condition(&loop, condition, builder);
+ *   ... build the body (the builder is in the body) ...
+ *   end_loop(&loop, hints, builder);
+ *
+ * after which the builder is positioned in the exit block.
+ */
+struct loop begin_while(const char* name, LLVMBuilderRef builder) {
+    return append_loop_blocks(name, builder);
+}
+
+void while_condition(struct loop* loop, LLVMValueRef condition, LLVMBuilderRef builder) {
+    build_cond_br(condition, loop->body, loop->exit, builder);
+    LLVMPositionBuilderAtEnd(builder, loop->body);
+}
+
+/*
+ * Counted loops: for (i = start; i < end; i += step).  The induction
+ * variable lives in a phi in the header instead of in an alloca, so LLVM
+ * recognizes it without having to run mem2reg first.  The body is built
+ * between begin_for() and end_loop(), and can use loop.induction.
+ */
+struct loop begin_for(const char* name, LLVMValueRef start, LLVMValueRef end, LLVMValueRef step, LLVMBuilderRef builder) {
+    // The bounds are converted in the preheader, since the phi has to come
+    // first in the header.
+    LLVMTypeRef type = common_type(start, end);
+    start = convert(start, type, builder);
+    end = convert(end, type, builder);
+
+    struct loop loop = append_loop_blocks(name, builder);
+    loop.step = step;
+    loop.induction = LLVMBuildPhi(builder, type, name);
+
+    LLVMValueRef incoming_values[] = { start };
+    LLVMBasicBlockRef incoming_blocks[] = { loop.preheader };
+    LLVMAddIncoming(loop.induction, incoming_values, incoming_blocks, 1);
+
+    LLVMValueRef condition = less_than(loop.induction, end, builder);
+    while_condition(&loop, condition, builder);
+    return loop;
+}
+
+void end_loop(struct loop* loop, struct loop_hints hints, LLVMBuilderRef builder) {
+    // The vectorizer won't reorder a float reduction on its own, but the
+    // fast policy says it may.  This matters most before LLVM 18, where the
+    // instructions themselves can't carry the fast-math flags.
+    if (current_float_policy == FLOAT_FAST && hints.vectorize == 0) {
+        hints.vectorize = 1;
+    }
+
+    LLVMBuildBr(builder, loop->latch);
+    LLVMPositionBuilderAtEnd(builder, loop->latch);
+
+    if (loop->induction) {
+        LLVMValueRef step = convert(loop->step, LLVMTypeOf(loop->induction), builder);
+        LLVMValueRef next = is_integer(step)
+            ? LLVMBuildNSWAdd(builder, loop->induction, step, "next")
+            : LLVMBuildFAdd(builder, loop->induction, step, "next");
+        LLVMValueRef incoming_values[] = { next };
+        LLVMBasicBlockRef incoming_blocks[] = { loop->latch };
+        LLVMAddIncoming(loop->induction, incoming_values, incoming_blocks, 1);
+    }
+
+    LLVMValueRef latch_branch = LLVMBuildBr(builder, loop->header);
+    attach_loop_hints(latch_branch, hints);
+    LLVMPositionBuilderAtEnd(builder, loop->exit);
+}
+
+/*
+ * Runs the standard -O3 pipeline (including the loop vectorizer and
+ * unroller) for the host machine over the module.
+ */
+void optimize_module(LLVMModuleRef module) {
+    LLVMInitializeNativeTarget();
+    LLVMInitializeNativeAsmPrinter();
+
+    char* triple = LLVMGetDefaultTargetTriple();
+    char* error = NULL;
+    LLVMTargetRef target = NULL;
+    if (LLVMGetTargetFromTriple(triple, &target, &error)) {
+        fprintf(stderr, "Error: %s\n", error);
+        LLVMDisposeMessage(error);
+        LLVMDisposeMessage(triple);
+        return;
+    }
+
+    char* cpu = LLVMGetHostCPUName();
+    char* features = LLVMGetHostCPUFeatures();
+    LLVMTargetMachineRef machine = LLVMCreateTargetMachine(
+        target, triple, cpu, features,
+        LLVMCodeGenLevelAggressive, LLVMRelocDefault, LLVMCodeModelDefault
+    );
+
+    LLVMSetTarget(module, triple);
+    LLVMTargetDataRef data_layout = LLVMCreateTargetDataLayout(machine);
+    char* data_layout_string = LLVMCopyStringRepOfTargetData(data_layout);
+    LLVMSetDataLayout(module, data_layout_string);
+
+    LLVMPassBuilderOptionsRef options = LLVMCreatePassBuilderOptions();
+    LLVMPassBuilderOptionsSetLoopVectorization(options, 1);
+    LLVMPassBuilderOptionsSetLoopUnrolling(options, 1);
+    LLVMErrorRef result = LLVMRunPasses(module, "default<O3>", machine, options);
+    if (result) {
+        char* message = LLVMGetErrorMessage(result);
+        fprintf(stderr, "Error: %s\n", message);
+        LLVMDisposeErrorMessage(message);
+    }
+
+    LLVMDisposePassBuilderOptions(options);
+    LLVMDisposeMessage(data_layout_string);
+    LLVMDisposeTargetData(data_layout);
+    LLVMDisposeTargetMachine(machine);
+    LLVMDisposeMessage(features);
+    LLVMDisposeMessage(cpu);
+    LLVMDisposeMessage(triple);
+}
+
+double seconds_since(struct timespec start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/*
+ * Builds
+ *
+ *   float dot_fn(float* a, float* b, int n) {
+ *       float sum = 0.0;
+ *       for (int i = 0; i < n; i += 1) {
+ *           sum = sum + a[i] * b[i];
+ *       }
+ *       return sum;
+ *   }
+ *
+ * into module, with the given precision policy.
+ */
+LLVMValueRef build_dot_fn(LLVMModuleRef module, enum float_policy policy) {
+    struct hash* symbols = hash_create();
+    LLVMBuilderRef builder = LLVMCreateBuilder();
+
+    LLVMTypeRef float_pointer = LLVMPointerType(types.float_type, 0);
+    LLVMTypeRef param_types[] = { float_pointer, float_pointer, types.i32 };
+    LLVMTypeRef dot_fn_sig = LLVMFunctionType(types.float_type, param_types, 3, 0);
+    LLVMValueRef dot_fn = LLVMAddFunction(module, "dot_fn", dot_fn_sig);
+    start_branch_numbering(dot_fn);
+    set_float_policy(dot_fn, policy);
+    LLVMValueRef a = LLVMGetParam(dot_fn, 0);
+    LLVMValueRef b = LLVMGetParam(dot_fn, 1);
+    LLVMValueRef n = LLVMGetParam(dot_fn, 2);
+    LLVMBasicBlockRef block = LLVMAppendBasicBlock(dot_fn, "block");
+    LLVMPositionBuilderAtEnd(builder, block);
+
+    assign("sum", constant(0.0), symbols, builder);
+
+    struct loop_hints for_hints = { 0, 0, 0 };
+    struct loop for_loop = begin_for("i", constant_int(0), n, constant_int(1), builder);
+    LLVMValueRef a_i = get_element(a, for_loop.induction, types.float_type, builder);
+    LLVMValueRef b_i = get_element(b, for_loop.induction, types.float_type, builder);
+    LLVMValueRef product = arithmetic_operation("*", a_i, b_i, builder);
+    LLVMValueRef sum = get_variable("sum", symbols, builder);
+    assign("sum", arithmetic_operation("+", sum, product, builder), symbols, builder);
+    end_loop(&for_loop, for_hints, builder);
+
+    LLVMBuildRet(builder, get_variable("sum", symbols, builder));
+    LLVMDisposeBuilder(builder);
+    return dot_fn;
+}
+
+/*
+ * Builds
+ *
+ *   int count_fn(int* values, int n) {
+ *       int small = 0;
+ *       int large = 0;
+ *       for (int i = 0; i < n; i += 1) {
+ *           if (values[i] < 100) {
+ *               small = small + 1;
+ *           } else {
+ *               large = large + values[i];
+ *           }
+ *       }
+ *       return small + large;
+ *   }
+ *
+ * into module.
+ */
+LLVMValueRef build_count_fn(LLVMModuleRef module) {
+    struct hash* symbols = hash_create();
+    LLVMBuilderRef builder = LLVMCreateBuilder();
+
+    LLVMTypeRef param_types[] = { LLVMPointerType(types.i32, 0), types.i32 };
+    LLVMTypeRef count_fn_sig = LLVMFunctionType(types.i32, param_types, 2, 0);
+    LLVMValueRef count_fn = LLVMAddFunction(module, "count_fn", count_fn_sig);
+    start_branch_numbering(count_fn);
+    LLVMValueRef values = LLVMGetParam(count_fn, 0);
+    LLVMValueRef n = LLVMGetParam(count_fn, 1);
+    LLVMBasicBlockRef block = LLVMAppendBasicBlock(count_fn, "block");
+    LLVMPositionBuilderAtEnd(builder, block);
+
+    assign("small", constant_int(0), symbols, builder);
+    assign("large", constant_int(0), symbols, builder);
+
+    struct loop_hints for_hints = { 0, 0, 0 };
+    struct loop for_loop = begin_for("i", constant_int(0), n, constant_int(1), builder);
+    LLVMValueRef value = get_element(values, for_loop.induction, types.i32, builder);
+    struct if_else if_small = begin_if(less_than(value, constant_int(100), builder), builder);
+    LLVMValueRef small = get_variable("small", symbols, builder);
+    assign("small", arithmetic_operation("+", small, constant_int(1), builder), symbols, builder);
+    begin_else(&if_small, builder);
+    LLVMValueRef large = get_variable("large", symbols, builder);
+    assign("large", arithmetic_operation("+", large, value, builder), symbols, builder);
+    end_if(&if_small, builder);
+    end_loop(&for_loop, for_hints, builder);
+
+    LLVMValueRef small_result = get_variable("small", symbols, builder);
+    LLVMValueRef large_result = get_variable("large", symbols, builder);
+    LLVMBuildRet(builder, arithmetic_operation("+", small_result, large_result, builder));
+    LLVMDisposeBuilder(builder);
+    return count_fn;
+}
+
+/*
+ * Builds
+ *
+ *   int select_fn(int* values, int n) {
+ *       int sum = 0;
+ *       for (int i = 0; i < n; i += 1) {
+ *           int value = values[i];
+ *           if (value < 128) {
+ *               sum = sum + value;
+ *           } else {
+ *               sum = sum - value;
+ *           }
+ *       }
+ *       return sum;
+ *   }
+ *
+ * into module.
+ */
+LLVMValueRef build_select_fn(LLVMModuleRef module) {
+    struct hash* symbols = hash_create();
+    LLVMBuilderRef builder = LLVMCreateBuilder();
+
+    LLVMTypeRef param_types[] = { LLVMPointerType(types.i32, 0), types.i32 };
+    LLVMTypeRef select_fn_sig = LLVMFunctionType(types.i32, param_types, 2, 0);
+    LLVMValueRef select_fn = LLVMAddFunction(module, "select_fn", select_fn_sig);
+    start_branch_numbering(select_fn);
+    LLVMValueRef values = LLVMGetParam(select_fn, 0);
+    LLVMValueRef n = LLVMGetParam(select_fn, 1);
+    LLVMBasicBlockRef block = LLVMAppendBasicBlock(select_fn, "block");
+    LLVMPositionBuilderAtEnd(builder, block);
+
+    assign("sum", constant_int(0), symbols, builder);
+
+    struct loop_hints for_hints = { -1, 0, 1 };
+    struct loop for_loop = begin_for("i", constant_int(0), n, constant_int(1), builder);
+    LLVMValueRef value = assign_and_get_variable("value", get_element(values, for_loop.induction, types.i32, builder), symbols, builder);
+    LLVMValueRef condition = less_than(value, constant_int(128), builder);
+    LLVMValueRef then_start = arm_start(builder);
+    LLVMValueRef then_value = arithmetic_operation("+", get_variable("sum", symbols, builder), value, builder);
+    LLVMValueRef else_start = arm_start(builder);
+    LLVMValueRef else_value = arithmetic_operation("-", get_variable("sum", symbols, builder), value, builder);
+    assign_if_else("sum", condition, then_start, then_value, else_start, else_value, symbols, builder);
+    end_loop(&for_loop, for_hints, builder);
+
+    LLVMBuildRet(builder, get_variable("sum", symbols, builder));
+    LLVMDisposeBuilder(builder);
+    return select_fn;
+}
+
+/*
+ * Compiles select_fn with branches (threshold 0) and with a select, and runs
+ * both on the same values in random and in sorted order.  Sorted values make
+ * the branch easy to predict; random ones make it miss about half the time.
+ * Only mem2reg runs before code generation, since the full pipeline would
+ * turn the branches into selects by itself.
+ */
+void compare_select_lowering(int n) {
+    int* random_values = malloc(n * sizeof(int));
+    int* sorted_values = malloc(n * sizeof(int));
+    int counts[256] = {0};
+    srand(480);
+    for (int i = 0; i < n; i++) {
+        random_values[i] = rand() % 256;
+        counts[random_values[i]]++;
+    }
+    for (int value = 0, i = 0; value < 256; value++) {
+        while (counts[value]-- > 0) {
+            sorted_values[i++] = value;
+        }
+    }
+
+    LLVMLinkInMCJIT();
+    LLVMInitializeNativeTarget();
+    LLVMInitializeNativeAsmPrinter();
+    int thresholds[] = { 0, select_cost_threshold };
+    for (int t = 0; t < 2; t++) {
+        select_cost_threshold = thresholds[t];
+        LLVMModuleRef module = LLVMModuleCreateWithName("lecture.code.17.benchmark");
+        build_select_fn(module);
+        finish_module(module);
+        LLVMPassBuilderOptionsRef options = LLVMCreatePassBuilderOptions();
+        LLVMErrorRef pass_error = LLVMRunPasses(module, "mem2reg", NULL, options);
+        if (pass_error) {
+            LLVMConsumeError(pass_error);
+        }
+        LLVMDisposePassBuilderOptions(options);
+
+        LLVMExecutionEngineRef engine;
+        struct LLVMMCJITCompilerOptions jit_options;
+        LLVMInitializeMCJITCompilerOptions(&jit_options, sizeof(jit_options));
+        jit_options.OptLevel = 2;
+        char* error = NULL;
+        if (LLVMCreateMCJITCompilerForModule(&engine, module, &jit_options, sizeof(jit_options), &error)) {
+            fprintf(stderr, "Error: %s\n", error);
+            LLVMDisposeMessage(error);
+            continue;
+        }
+        int (*select_fn)(int*, int) = (int (*)(int*, int))LLVMGetFunctionAddress(engine, "select_fn");
+
+        int* inputs[] = { random_values, sorted_values };
+        const char* input_names[] = { "random", "sorted" };
+        for (int input = 0; input < 2; input++) {
+            double best = 1e9;
+            int result = 0;
+            for (int run = 0; run < 5; run++) {
+                struct timespec start;
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                result = select_fn(inputs[input], n);
+                double elapsed = seconds_since(start);
+                best = elapsed < best ? elapsed : best;
+            }
+            printf("%-6s  %s  %8.3f ms  (result %d)\n",
+                   t == 0 ? "branch" : "select", input_names[input], best * 1e3, result);
+        }
+        LLVMDisposeExecutionEngine(engine);
+    }
+    select_cost_threshold = thresholds[1];
+
+    free(random_values);
+    free(sorted_values);
+}
+
+/*
+ * Builds
+ *
+ *   int arms_fn(int x) {
+ *       int z = 0;
+ *       if (x < 8) {
+ *           z = x * 3;    // or z = 7
+ *       } else {
+ *           z = x + 5;    // or z = 9
+ *       }
+ *       return z;
+ *   }
+ *
+ * into module, with the constant in the arms that are empty_then and
+ * empty_else.  A constant builds no instructions, so that arm is empty.
+ */
+LLVMValueRef build_arms_fn(LLVMModuleRef module, int empty_then, int empty_else) {
+    struct hash* symbols = hash_create();
+    LLVMBuilderRef builder = LLVMCreateBuilder();
+
+    LLVMTypeRef param_types[] = { types.i32 };
+    LLVMValueRef arms_fn = LLVMAddFunction(module, "arms_fn", LLVMFunctionType(types.i32, param_types, 1, 0));
+    start_branch_numbering(arms_fn);
+    LLVMValueRef x = LLVMGetParam(arms_fn, 0);
+    LLVMPositionBuilderAtEnd(builder, LLVMAppendBasicBlock(arms_fn, "block"));
+
+    assign("z", constant_int(0), symbols, builder);
+    LLVMValueRef condition = less_than(x, constant_int(8), builder);
+    LLVMValueRef then_start = arm_start(builder);
+    LLVMValueRef then_value = empty_then ? constant_int(7) : arithmetic_operation("*", x, constant_int(3), builder);
+    LLVMValueRef else_start = arm_start(builder);
+    LLVMValueRef else_value = empty_else ? constant_int(9) : arithmetic_operation("+", x, constant_int(5), builder);
+    assign_if_else("z", condition, then_start, then_value, else_start, else_value, symbols, builder);
+
+    LLVMBuildRet(builder, get_variable("z", symbols, builder));
+    LLVMDisposeBuilder(builder);
+    return arms_fn;
+}
+
+/*
+ * Builds arms_fn with every combination of empty arms, both with branches
+ * (threshold 0) and with a select, and checks that each one verifies and
+ * computes the right z on both sides of the condition.
+ */
+int check_empty_arms(void) {
+    LLVMLinkInMCJIT();
+    LLVMInitializeNativeTarget();
+    LLVMInitializeNativeAsmPrinter();
+    int thresholds[] = { 0, select_cost_threshold };
+    int failed = 0;
+    for (int t = 0; t < 2; t++) {
+        select_cost_threshold = thresholds[t];
+        for (int arms = 0; arms < 4; arms++) {
+            int empty_then = arms & 1, empty_else = arms >> 1;
+            LLVMModuleRef module = LLVMModuleCreateWithName("lecture.code.17.check");
+            build_arms_fn(module, empty_then, empty_else);
+            char* error = NULL;
+            if (LLVMVerifyModule(module, LLVMReturnStatusAction, &error)) {
+                fprintf(stderr, "Threshold %d, empty then %d, empty else %d: %s\n",
+                        select_cost_threshold, empty_then, empty_else, error);
+                LLVMDisposeMessage(error);
+                LLVMDisposeModule(module);
+                failed++;
+                continue;
+            }
+            LLVMDisposeMessage(error);
+
+            LLVMExecutionEngineRef engine;
+            struct LLVMMCJITCompilerOptions jit_options;
+            LLVMInitializeMCJITCompilerOptions(&jit_options, sizeof(jit_options));
+            if (LLVMCreateMCJITCompilerForModule(&engine, module, &jit_options, sizeof(jit_options), &error)) {
+                fprintf(stderr, "Error: %s\n", error);
+                LLVMDisposeMessage(error);
+                failed++;
+                continue;
+            }
+            int (*arms_fn)(int) = (int (*)(int))LLVMGetFunctionAddress(engine, "arms_fn");
+            int inputs[] = { 3, 10 };
+            for (int i = 0; i < 2; i++) {
+                int x = inputs[i];
+                int expected = x < 8 ? (empty_then ? 7 : x * 3) : (empty_else ? 9 : x + 5);
+                if (arms_fn(x) != expected) {
+                    fprintf(stderr, "Threshold %d, empty then %d, empty else %d: arms_fn(%d) is %d, not %d\n",
+                            select_cost_threshold, empty_then, empty_else, x, arms_fn(x), expected);
+                    failed++;
+                }
+            }
+            LLVMDisposeExecutionEngine(engine);
+        }
+    }
+    select_cost_threshold = thresholds[1];
+    printf("%s\n", failed ? "FAILED" : "ok");
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+    /*
+        Generating IR code for the select_fn function above.  Both arms of
+        its if/else are cheap and safe to run, so it comes out without a
+        branch.
+
+        Run with -O to also print the module after the optimization
+        pipeline has run on it.  Run with -b to compare it with a branching
+        version on random and sorted inputs instead, or with --check to
+        check if/elses whose arms build nothing.
+    */
+    init_codegen(current_mode);
+
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+        compare_select_lowering(1 << 24);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--check") == 0) {
+        return check_empty_arms();
+    }
+
+    LLVMModuleRef module = LLVMModuleCreateWithName(
+        "lecture.code.17"
+    );
+    build_select_fn(module);
+    finish_module(module);
+
+    char* moduleString = LLVMPrintModuleToString(module);
+    printf("%s\n", moduleString);
+    LLVMDisposeMessage(moduleString);
+
+    if (argc > 1 && strcmp(argv[1], "-O") == 0) {
+        optimize_module(module);
+        moduleString = LLVMPrintModuleToString(module);
+        printf("%s\n", moduleString);
+        LLVMDisposeMessage(moduleString);
+    }
+
+    LLVMDisposeModule(module);
+    return 0;
+}
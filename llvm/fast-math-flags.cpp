@@ -0,0 +1,29 @@
+/*
+ * Sets fast-math flags on instructions for LLVM versions before 18, whose C
+ * API can't.  compiler-15.c and later use it when built with -DFAST_MATH_SHIM
+ * (see README.md).
+ */
+
+#include <llvm-c/Core.h>
+#include <llvm/IR/Instruction.h>
+#include <llvm/IR/Operator.h>
+#include <llvm/IR/Value.h>
+
+/*
+ * Gives value every fast-math flag if fast is set, and otherwise only the one
+ * that allows contraction.  Values that can't carry the flags, like integer
+ * instructions or constants the builder folded, are left alone.
+ */
+extern "C" void set_fast_math_flags(LLVMValueRef value, int fast) {
+    llvm::Value* instruction = llvm::unwrap(value);
+    if (!llvm::isa<llvm::Instruction>(instruction) || !llvm::isa<llvm::FPMathOperator>(instruction)) {
+        return;
+    }
+    llvm::FastMathFlags flags;
+    if (fast) {
+        flags.setFast();
+    } else {
+        flags.setAllowContract();
+    }
+    llvm::cast<llvm::Instruction>(instruction)->setFastMathFlags(flags);
+}
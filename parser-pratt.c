@@ -0,0 +1,453 @@
+/*
+ * Hand-written precedence climbing (Pratt) parser for parser.y's grammar.
+ *
+ * It reads the same tokens from the same scanner, and builds the same AST
+ * with the same calls, in the same order, so the rest of the driver can't
+ * tell the two parsers apart.  The difference is in how an expression is
+ * parsed.  Instead of an LALR state machine that looks up every token in its
+ * tables and copies a semantic value on every reduction, each operator has a
+ * binding power, and parse_expression() loops over operators that bind at
+ * least as tightly as the one it was called for, recursing only for the right
+ * operand.  A chain like a + b + c + ... is parsed in a loop, with no
+ * recursion at all.
+ *
+ * parser.y's main() uses it instead of yyparse() when given --pratt:
+ *
+ *   g++ parser.c scanner.c ast.c bytecode.c parser-pratt.c -o parser
+ *   ./parser --pratt < source.py
+ *
+ * Syntax errors are recovered from like parser.y's error rule does: the rest
+ * of the line is skipped, with the same messages.
+ *
+ * Built with -DPRATT_CHECK instead (which also leaves parser.y's main() out),
+ * it becomes a program that runs both parsers over the same input to check
+ * that they build the same AST and report the same errors, and to compare
+ * their speed on deeply nested and on long expressions:
+ *
+ *   g++ -O2 -DPRATT_CHECK parser.c scanner.c ast.c parser-pratt.c -o pratt-check
+ *   ./pratt-check                 # random inputs
+ *   ./pratt-check source.py       # the given files
+ *   ./pratt-check -b              # speed of both parsers
+ */
+
+#include <iostream>
+#include "ast.h"
+#include "parser.h"
+
+int yylex(void);
+void yyerror(const char* s);
+extern int yylineno;
+extern int skipped_statements;
+
+/*
+ * yyparse() gives up with "memory exhausted" once its stack would hold
+ * YYMAXDEPTH entries, which happens when an expression is nested deeply
+ * enough.  To fail on exactly the same inputs, depth counts the entries
+ * yyparse() would have on its stack at the same point: one for its start
+ * state, one for the statements already parsed, two for the target and the
+ * = of the statement being parsed, then two for each operator whose right
+ * operand is being parsed (for its left operand and itself), and one for each
+ * open parenthesis.  The same limit also keeps the recursion here from
+ * overflowing the C++ stack.
+ *
+ * YYMAXDEPTH is 10000 unless both parsers are built with -DYYMAXDEPTH=N.
+ */
+#ifdef YYMAXDEPTH
+#define MAX_DEPTH YYMAXDEPTH
+#else
+#define MAX_DEPTH 10000
+#endif
+
+/*
+ * The next token is only read when it's needed, as it is by parser.y, so
+ * yylineno is the same when a statement is skipped.
+ */
+static int lookahead = -1;
+static int depth = 0;
+
+static int peek() {
+    if (lookahead < 0) {
+        lookahead = yylex();
+    }
+    return lookahead;
+}
+
+static void consume() {
+    lookahead = -1;
+}
+
+static void discard() {
+    if (lookahead == IDENTIFIER || lookahead == INTEGER) {
+        delete yylval.str;
+    }
+    consume();
+}
+
+/*
+ * Checks whether yyparse() could push entries more symbols onto its stack.
+ */
+static bool fits(int entries) {
+    return depth + entries < MAX_DEPTH;
+}
+
+static int binding_power(int token) {
+    switch (token) {
+    case PLUS:
+    case MINUS:
+        return 1;
+    case TIMES:
+    case DIVIDEDBY:
+        return 2;
+    default:
+        return 0;
+    }
+}
+
+static ast_op operation(int token) {
+    switch (token) {
+    case PLUS: return AST_ADD;
+    case MINUS: return AST_SUB;
+    case TIMES: return AST_MUL;
+    default: return AST_DIV;
+    }
+}
+
+enum parse_status {
+    PARSED,
+    SYNTAX_ERROR,
+    TOO_DEEP
+};
+
+static parse_status parse_expression(int min_power, int* node);
+
+static parse_status parse_operand(int* node) {
+    int token = peek();
+    if ((token == INTEGER || token == IDENTIFIER || token == LPAREN) && !fits(1)) {
+        return TOO_DEEP;
+    }
+    if (token == INTEGER) {
+        *node = ast_integer(*yylval.str);
+        discard();
+        return PARSED;
+    } else if (token == IDENTIFIER) {
+        *node = ast_variable(*yylval.str);
+        discard();
+        return PARSED;
+    } else if (token != LPAREN) {
+        return SYNTAX_ERROR;
+    }
+
+    consume();
+    depth++;
+    parse_status status = parse_expression(1, node);
+    if (status == PARSED && peek() != RPAREN) {
+        status = SYNTAX_ERROR;
+    } else if (status == PARSED && !fits(2)) {
+        // The expression and the ) are pushed before they're reduced
+        status = TOO_DEEP;
+    } else if (status == PARSED) {
+        consume();
+    }
+    depth--;
+    return status;
+}
+
+/*
+ * Parses an expression whose operators all bind at least min_power tightly.
+ * All of the operators are left-associative, so the right operand of an
+ * operator only takes operators that bind more tightly than it does.
+ */
+static parse_status parse_expression(int min_power, int* node) {
+    parse_status status = parse_operand(node);
+    while (status == PARSED) {
+        int token = peek();
+        int power = binding_power(token);
+        if (power == 0 || power < min_power) {
+            return PARSED;
+        }
+        if (!fits(2)) {
+            return TOO_DEEP;
+        }
+        consume();
+
+        depth += 2;
+        int right;
+        status = parse_expression(power + 1, &right);
+        depth -= 2;
+        if (status == PARSED) {
+            *node = ast_binary(operation(token), *node, right);
+        }
+    }
+    return status;
+}
+
+static parse_status parse_statement() {
+    if (peek() != IDENTIFIER) {
+        return SYNTAX_ERROR;
+    }
+    std::string* target = yylval.str;
+    consume();
+
+    parse_status status = SYNTAX_ERROR;
+    int value;
+    if (peek() == ASSIGN) {
+        consume();
+        status = parse_expression(1, &value);
+        if (status == PARSED && peek() != NEWLINE) {
+            status = SYNTAX_ERROR;
+        }
+    }
+    if (status == PARSED) {
+        consume();
+        ast_assign(*target, value);
+    }
+    delete target;
+    return status;
+}
+
+/*
+ * Skips the rest of a statement with a syntax error, up to and including its
+ * NEWLINE.  Returns false if the input ends first.
+ */
+static bool skip_statement() {
+    for (;;) {
+        int token = peek();
+        if (token == YYEOF) {
+            return false;
+        }
+        discard();
+        if (token == NEWLINE) {
+            break;
+        }
+    }
+    std::cerr << "Skipped statement on line " << yylineno - 1 << ": " << finished_line() << std::endl;
+    skipped_statements++;
+    return true;
+}
+
+/*
+ * Parses the whole input, and returns what yyparse() would have: 0 if the
+ * input was parsed (possibly with skipped statements), 1 if it ended in the
+ * middle of a bad statement (or had no statements at all), and 2 if an
+ * expression was nested too deeply.
+ */
+int pratt_parse() {
+    lookahead = -1;
+    bool empty = true;
+    for (;;) {
+        if (peek() == YYEOF && !empty) {
+            return 0;
+        }
+        depth = empty ? 3 : 4;
+        empty = false;
+
+        parse_status status = parse_statement();
+        if (status == TOO_DEEP) {
+            yyerror("memory exhausted");
+            return 2;
+        } else if (status == SYNTAX_ERROR) {
+            yyerror("syntax error");
+            if (!skip_statement()) {
+                return 1;
+            }
+        }
+    }
+}
+
+#ifdef PRATT_CHECK
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+
+/*
+ * Everything a parse produces that the rest of the driver could see.
+ */
+struct parse_result {
+    int status;
+    int skipped;
+    int line;
+    std::string messages;
+    ast tree;
+};
+
+static parse_result parse_text(const std::string& text, bool pratt) {
+    FILE* input = fmemopen((void*)text.data(), text.size(), "r");
+    ast_reset();
+    skipped_statements = 0;
+    restart_scanner(input);
+    std::ostringstream messages;
+    std::streambuf* cerr_buffer = std::cerr.rdbuf(messages.rdbuf());
+
+    parse_result result;
+    result.status = pratt ? pratt_parse() : yyparse();
+    std::cerr.rdbuf(cerr_buffer);
+    fclose(input);
+    result.skipped = skipped_statements;
+    result.line = yylineno;
+    result.messages = messages.str();
+    result.tree = program;
+    return result;
+}
+
+static bool same_ast(const ast& a, const ast& b) {
+    return a.op == b.op && a.left == b.left && a.right == b.right && a.value == b.value
+        && a.stmt_target == b.stmt_target && a.stmt_value == b.stmt_value
+        && a.symbol_names == b.symbol_names && a.literal_texts == b.literal_texts;
+}
+
+/*
+ * Runs both parsers over text, and reports the first way in which they
+ * differ.
+ */
+static bool same_parse(const std::string& text, const std::string& name) {
+    parse_result expected = parse_text(text, false);
+    parse_result actual = parse_text(text, true);
+    const char* difference = NULL;
+    if (actual.status != expected.status) {
+        difference = "status";
+    } else if (actual.skipped != expected.skipped || actual.messages != expected.messages) {
+        difference = "errors";
+    } else if (actual.line != expected.line) {
+        difference = "line number";
+    } else if (!same_ast(actual.tree, expected.tree)) {
+        difference = "AST";
+    }
+    if (difference) {
+        fprintf(stderr, "%s: the %s differs: yyparse() returned %d with %d skipped, pratt_parse() %d with %d skipped\n",
+            name.c_str(), difference, expected.status, expected.skipped, actual.status, actual.skipped);
+    }
+    return !difference;
+}
+
+static std::string random_expression(std::mt19937& random, int depth) {
+    static const char* leaves[] = { "a", "b", "x1", "_t", "0", "7", "42", "2147483648" };
+    static const char* operators[] = { " + ", " - ", " * ", " / ", "+", "*" };
+    unsigned choice = random() % 20;
+    if (depth > 6 || choice < 6) {
+        return leaves[random() % (sizeof(leaves) / sizeof(leaves[0]))];
+    } else if (choice < 9) {
+        return "(" + random_expression(random, depth + 1) + ")";
+    }
+    return random_expression(random, depth + 1) + operators[random() % (sizeof(operators) / sizeof(operators[0]))]
+        + random_expression(random, depth + 1);
+}
+
+/*
+ * Random statements, some of them with a stray token in them, and some blank
+ * lines.
+ */
+static std::string random_program(std::mt19937& random) {
+    static const char* strays[] = { "+", "*", "(", ")", "=", "\n", "1", "a", "if", "$", "  " };
+    std::string text;
+    for (int lines = random() % 40; lines > 0; lines--) {
+        std::string line = std::string(1, "abxy"[random() % 4]) + " = " + random_expression(random, 0);
+        if (random() % 5 == 0) {
+            line.insert(random() % (line.size() + 1), strays[random() % (sizeof(strays) / sizeof(strays[0]))]);
+        }
+        if (random() % 10 == 0) {
+            line.clear();
+        }
+        text += line + "\n";
+    }
+    if (random() % 5 == 0 && !text.empty()) {
+        text.pop_back();
+    }
+    return text;
+}
+
+/*
+ * An expression nested just about deeply enough to fill yyparse()'s stack,
+ * in one of three shapes that take 1, 3 or 5 stack entries per level.
+ */
+static std::string deep_program(std::mt19937& random) {
+    static const char* opens[] = { "(", "1 + (", "1 + 2 * (" };
+    static const int entries[] = { 1, 3, 5 };
+    int shape = random() % 3;
+    int levels = MAX_DEPTH / entries[shape] + (int)(random() % 9) - 4;
+    std::string text = random() % 2 ? "x = 1\n" : "";
+    text += "y = ";
+    for (int i = 0; i < levels; i++) {
+        text += opens[shape];
+    }
+    text += "1";
+    text += std::string(levels, ')');
+    return text + "\n";
+}
+
+static bool read_file(const char* path, std::string& text) {
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    text = contents.str();
+    return !file.fail();
+}
+
+/*
+ * Parses text with each parser a few times, and reports the fastest run.
+ */
+static void compare_speed(const char* name, const std::string& text) {
+    for (int pratt = 0; pratt <= 1; pratt++) {
+        double best = 1e30;
+        for (int run = 0; run < 5; run++) {
+            auto start = std::chrono::steady_clock::now();
+            parse_result result = parse_text(text, pratt);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            best = std::min(best, elapsed.count());
+            if (result.status != 0) {
+                fprintf(stderr, "Error: %s input doesn't parse\n", name);
+            }
+        }
+        printf("%-4s  %-7s  %8.1f MB/s\n", name, pratt ? "pratt" : "yyparse", text.size() / best / 1e6);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+        // Statements nested as deeply as yyparse() allows, and statements
+        // with long chains of operators.
+        std::string deep, wide;
+        for (int i = 0; deep.size() < (16 << 20); i++) {
+            int levels = MAX_DEPTH / 3 - 10;
+            deep += "x = ";
+            for (int level = 0; level < levels; level++) {
+                deep += std::to_string(level) + " + (";
+            }
+            deep += std::to_string(i) + std::string(levels, ')') + "\n";
+        }
+        for (int i = 0; wide.size() < (16 << 20); i++) {
+            wide += "x = " + std::to_string(i);
+            for (int term = 0; term < 1000; term++) {
+                wide += " + y * " + std::to_string(term) + " - z / 3";
+            }
+            wide += "\n";
+        }
+        compare_speed("deep", deep);
+        compare_speed("wide", wide);
+        return 0;
+    }
+
+    int failed = 0;
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            std::string text;
+            if (!read_file(argv[i], text)) {
+                fprintf(stderr, "Error: can't read %s\n", argv[i]);
+                return 1;
+            }
+            failed += !same_parse(text, argv[i]);
+        }
+    } else {
+        std::mt19937 random(1);
+        for (int round = 0; round < 2000; round++) {
+            std::string text = round % 10 == 0 ? deep_program(random) : random_program(random);
+            failed += !same_parse(text, "random input " + std::to_string(round));
+        }
+    }
+    printf("%s\n", failed ? "FAILED" : "ok");
+    return failed ? 1 : 0;
+}
+#endif
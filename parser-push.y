@@ -1,11 +1,26 @@
 %{
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <set>
 #include "parser-push.h"
+#include "reparse.h"
+#include "token-ring.h"
 
 void yyerror(YYLTYPE* loc, const char* err);
 int yylex();
 std::set<std::string> symbols;
+int skipped_statements = 0;
+
+/*
+ * For incremental reparsing (see reparse.h): the symbols in the order they
+ * were declared, how many statements have ended, and where translated lines
+ * go instead of std::cout, if anywhere.
+ */
+std::vector<std::string> declared;
+size_t statements_ended = 0;
+std::vector<std::string>* output = NULL;
 
 %}
 
@@ -15,6 +30,26 @@ std::set<std::string> symbols;
 %define api.pure full
 %define api.push-pull push
 
+%code provides {
+  struct token_ring;
+  int parse_token_ring(token_ring* ring);
+
+  #include <cstddef>
+
+  /*
+   * Scans and parses text instead of stdin (in scanner-push.l).
+   */
+  int scan_text(const char* text, size_t length);
+
+#ifdef PIPELINE
+  /*
+   * Whether scan_text() and yylex() run the parser on a thread of its own
+   * (see token-ring.h).  On by default.
+   */
+  extern bool pipeline_tokens;
+#endif
+}
+
 /*
  * These are all of the terminals in our grammar, i.e. the syntactic
  * categories that can be recognized by the lexer.
@@ -25,6 +60,23 @@ std::set<std::string> symbols;
 %token PLUS MINUS TIMES DIVIDEDBY
 %token ASSIGN
 
+/*
+ * Generated by the scanner when a line is indented more (INDENT) or less
+ * (DEDENT) than the line before it.  A line that closes several blocks at
+ * once produces one DEDENT per block.
+ *
+ * The tokens up to here are declared in the same order in parser.y, so both
+ * parsers give them the same numbers (see token-cache.h).
+ */
+%token INDENT DEDENT
+
+/*
+ * Values that are thrown away during error recovery still have to be freed.
+ * Only these symbols carry a value.  A NEWLINE's value is the text of the line
+ * it ends, which is reported if the line has to be skipped.
+ */
+%destructor { delete $$; } IDENTIFIER INTEGER expression NEWLINE
+
 /*
  * Here, we're defining the precedence of the operators.  The ones that appear
  * later have higher precedence.  All of the operators are left-associative
@@ -38,19 +90,57 @@ std::set<std::string> symbols;
 %%
 
 input
-  : input assignmentStatement
-  | assignmentStatement
+  : input statement
+  | statement
+  ;
+
+/*
+ * The language doesn't have compound statements yet, so an indented block is
+ * simply more statements, translated like the ones around it.  The scanner
+ * always closes every block it opens, at the latest at the end of the input.
+ *
+ * The scanner never opens a block without a statement in it, but a block may
+ * still look empty to a parser that was started in the middle of it, after
+ * its last statement (see scan_lines() in scanner-push.l).
+ */
+statement
+  : assignmentStatement
+  | INDENT block DEDENT
+  ;
+
+block
+  : %empty
+  | block statement
   ;
     
 assignmentStatement
   : IDENTIFIER ASSIGN expression NEWLINE {
-      if (symbols.find(*$1) == symbols.end()) {
-        symbols.insert(*$1);
-        std::cout << "int " << *$1 << " = " << *$3 << ";" << std::endl;
+      std::string line = *$1 + " = " + *$3 + ";";
+      if (symbols.insert(*$1).second) {
+        declared.push_back(*$1);
+        line = "int " + line;
+      }
+      if (output) {
+        output->push_back(line);
       } else {
-        std::cout << *$1 << " = " << *$3 << ";" << std::endl;  
+        std::cout << line << std::endl;
       }
-      delete $1; delete $3;
+      statements_ended++;
+      delete $1; delete $3; delete $4;
+    }
+  /*
+   * If a statement has a syntax error, we skip to the end of its line and
+   * carry on with the next statement, so one bad line doesn't stop the whole
+   * translation.  The scanner counts a newline before pushing it, so the bad
+   * statement is on the line before the NEWLINE's.  An unterminated last line
+   * gets a NEWLINE too, so it is counted like any other.
+   */
+  | error NEWLINE {
+      std::cerr << "Skipped statement on line " << @2.first_line - 1 << ": " << *$2 << std::endl;
+      delete $2;
+      skipped_statements++;
+      statements_ended++;
+      yyerrok;
     }
   ;
 
@@ -71,10 +161,124 @@ assignmentStatement
 
 %%
 
+#ifndef PUSH_PARSER
+/*
+ * Generates num_statements statements for the benchmarks below, either all
+ * at the top level or nested in blocks that go 90 levels deep before all of
+ * them are closed by a single line.
+ */
+static std::string benchmark_text(int num_statements, bool nested) {
+  const int max_depth = 90;
+  std::string text;
+  for (int i = 0; i < num_statements; i++) {
+    if (nested) {
+      text.append(2 * (i % max_depth), ' ');
+    }
+    text += std::string(1, 'a' + i % 26) + " = " + std::string(1, 'a' + (i + 1) % 26) + " * 3 + " + std::to_string(i) + "\n";
+  }
+  return text;
+}
+
+/*
+ * Scans and parses text, translating into a vector instead of std::cout, and
+ * prints how fast that went.
+ */
+static void time_scan(const char* name, const std::string& text, int num_statements) {
+  std::vector<std::string> lines;
+  output = &lines;
+  symbols.clear();
+  declared.clear();
+  skipped_statements = 0;
+  auto start = std::chrono::steady_clock::now();
+  scan_text(text.data(), text.size());
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  output = NULL;
+
+  printf("%-11s  %8.1f MB/s  %8.2f M statements/s  (%zu translated, %d skipped)\n",
+    name, text.size() / elapsed.count() / 1e6,
+    num_statements / elapsed.count() / 1e6, lines.size(), skipped_statements);
+}
+#endif
+
+#if !defined(PIPELINE) && !defined(PUSH_PARSER)
+/*
+ * Scans and parses num_statements statements twice: once with every
+ * statement at the top level, and once nested in blocks.  Tracking the
+ * indentation shouldn't cost much more than reading the extra bytes.  (With
+ * tokens replayed from a cache (-DPUSH_PARSER, see token-replay.c) there is
+ * no scanner, so there's no benchmark there.)
+ */
+static void compare_indentation(int num_statements) {
+  for (int nested = 0; nested <= 1; nested++) {
+    time_scan(nested ? "nested" : "flat", benchmark_text(num_statements, nested), num_statements);
+  }
+}
+#endif
+
+#ifdef PIPELINE
+/*
+ * Scans and parses the same num_statements statements with the parser on the
+ * scanner's thread and then on its own thread.  Pipelining only pays off if
+ * the two overlap well enough to make up for handing every token over.
+ */
+static void compare_pipeline(int num_statements) {
+  std::string text = benchmark_text(num_statements, false);
+  for (int pipelined = 0; pipelined <= 1; pipelined++) {
+    pipeline_tokens = pipelined;
+    time_scan(pipelined ? "pipelined" : "synchronous", text, num_statements);
+  }
+  pipeline_tokens = true;
+}
+#endif
+
 int main(int argc, char **argv)
 {
-  yylex();
-  return 0;
+#ifdef REPARSE
+  if (argc == 4 && strcmp(argv[1], "--reparse") == 0) {
+    return reparse_files(argv[2], argv[3]);
+  }
+  if (argc == 2 && strcmp(argv[1], "--check") == 0) {
+    return check_reparse();
+  }
+#endif
+#ifndef PUSH_PARSER
+  if (argc == 2 && strcmp(argv[1], "-b") == 0) {
+#ifdef PIPELINE
+    compare_pipeline(1 << 20);
+#else
+    compare_indentation(1 << 20);
+#endif
+    return 0;
+  }
+#else
+  // Replaying a token cache (see token-replay.c) takes no options.
+  (void)argc;
+  (void)argv;
+#endif
+  int status = yylex();
+  std::cerr << skipped_statements << " statement(s) skipped" << std::endl;
+  return status != 0 || skipped_statements > 0;
+}
+
+/*
+ * Pushes the tokens from ring into a new parser until it accepts the input
+ * or gives up, and returns its final status.  scanner-push.l's pipeline mode
+ * runs this on its own thread while it scans (see token-ring.h).
+ */
+int parse_token_ring(token_ring* ring) {
+  yypstate* pstate = yypstate_new();
+  YYSTYPE yylval;
+  YYLTYPE loc;
+  int status = YYPUSH_MORE;
+  while (status == YYPUSH_MORE) {
+    ring_token token = token_ring_get(ring);
+    yylval = token.value;
+    loc.first_line = loc.last_line = token.line;
+    status = yypush_parse(pstate, token.kind, &yylval, &loc);
+  }
+  token_ring_close(ring);
+  yypstate_delete(pstate);
+  return status;
 }
 
 void yyerror(YYLTYPE* loc, const char* err) {
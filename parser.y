@@ -1,28 +1,91 @@
 %{
+#include <chrono>
+#include <climits>
 #include <iostream>
-#include <set>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include "ast.h"
+#include "bytecode.h"
+#ifdef EMIT_LLVM
+#include "compile-server.h"
+#include "tiered.h"
+#endif
 void yyerror(const char* s);
 int yylex(void);
+extern int yylineno;
 /*
  * These values are globals defined in the parsing function.
  */
-std::set<std::string> symbols;
+int skipped_statements = 0;
 %}
 /*
- * All program constructs will be represented as strings, specifically as
- * their corresponding C/C++ translation.
+ * The scanner hands us identifiers and integers as strings.  Everything else
+ * is represented by its node in the program's AST (see ast.h), which is
+ * translated once the whole program has been parsed.
  */
-%define api.value.type { std::string* }
+/*
+ * The scanners also let the parser start over on another input, which is used
+ * to parse many programs in one process (see compile-server.h).
+ */
+%code provides {
+#include <cstdio>
+#include <string>
+void restart_scanner(FILE* input);
+
+/*
+ * Hand-written parser for the same grammar, in parser-pratt.c.  It reads the
+ * same tokens and builds the same AST as yyparse().
+ */
+int pratt_parse();
+
+/*
+ * The text of the line the scanner has just finished, without its newline.
+ * It stays valid until the scanner is called again.
+ */
+const std::string& finished_line();
+}
+
+%union {
+  std::string* str;
+  int node;
+}
 /*
  * These are all of the terminals in our grammar, i.e. the syntactic
  * categories that can be recognized by the lexer.
  */
 
-%token NEWLINE INTEGER IDENTIFIER
+%token NEWLINE
+%token <str> INTEGER IDENTIFIER
 %token LPAREN RPAREN
 %token PLUS MINUS TIMES DIVIDEDBY
 %token ASSIGN
 
+/*
+ * Indentation tokens.  Only scanner-push.l generates these, but they are
+ * declared in the same place as in parser-push.y, so both parsers number the
+ * tokens they share the same way (see token-cache.h).
+ */
+%token INDENT DEDENT
+
+/*
+ * Keywords.  The grammar doesn't use them yet, but the scanner already
+ * recognizes them (see keywords.h), so they can't be used as variable names.
+ * Names that are only keywords in C++ are fine; emit_cpp() renames them.
+ */
+%token FALSE NONE TRUE AND AS ASSERT ASYNC AWAIT BREAK CLASS CONTINUE DEF
+%token DEL ELIF ELSE EXCEPT FINALLY FOR FROM GLOBAL IF IMPORT IN IS LAMBDA
+%token NONLOCAL NOT OR PASS RAISE RETURN TRY WHILE WITH YIELD
+
+%type <node> expression
+
+/*
+ * Strings that are thrown away during error recovery still have to be freed.
+ * AST nodes don't need to be; they simply aren't used.
+ */
+%destructor { delete $$; } <str>
+
 /*
  * Here, we're defining the precedence of the operators.  The ones that appear
  * later have higher precedence.  All of the operators are left-associative
@@ -42,40 +105,297 @@ input
     
 assignmentStatement
   : IDENTIFIER ASSIGN expression NEWLINE {
-      if (symbols.find(*$1) == symbols.end()) {
-        symbols.insert(*$1);
-        std::cout << "int " << *$1 << " = " << *$3 << ";" << std::endl;
-      } else {
-        std::cout << *$1 << " = " << *$3 << ";" << std::endl;  
-      }
-      delete $1; delete $3;
+      ast_assign(*$1, $3);
+      delete $1;
+    }
+  /*
+   * If a statement has a syntax error, we skip to the end of its line and
+   * carry on with the next statement, so one bad line doesn't stop the whole
+   * translation.  By the time NEWLINE is shifted, the scanner has already
+   * counted it, so the bad statement is on the line before yylineno.  The
+   * scanner ends an unterminated last line with a NEWLINE too, so a bad last
+   * statement is reported like any other.
+   */
+  | error NEWLINE {
+      std::cerr << "Skipped statement on line " << yylineno - 1 << ": " << finished_line() << std::endl;
+      skipped_statements++;
+      yyerrok;
     }
   ;
 
 /*
- * Symbol representing algebraic expressions.  For most forms of algebraic
- * expression, we generate a translated string that simply concatenates the
- * target language translations of the operands with the C++ translation of the operator.
+ * Symbol representing algebraic expressions.  Each form of expression adds a
+ * node to the AST.  Parentheses only affect the shape of the tree, so they
+ * don't need a node of their own.
  */
  expression
-  : LPAREN expression RPAREN { $$ = new std::string("(" + *$2 + ")"); delete $2; }
-  | expression PLUS expression { $$ = new std::string(*$1 + " + " + *$3); delete $1; delete $3; }
-  | expression TIMES expression { $$ = new std::string(*$1 + " * " + *$3); delete $1; delete $3; }
-  | expression MINUS expression { $$ = new std::string(*$1 + " - * " + *$3); delete $1; delete $3; }
-  | expression DIVIDEDBY expression { $$ = new std::string(*$1 + " / " + *$3); delete $1; delete $3; }
-  | INTEGER { $$ = $1; }
-  | IDENTIFIER { $$ = $1; }
+  : LPAREN expression RPAREN { $$ = $2; }
+  | expression PLUS expression { $$ = ast_binary(AST_ADD, $1, $3); }
+  | expression TIMES expression { $$ = ast_binary(AST_MUL, $1, $3); }
+  | expression MINUS expression { $$ = ast_binary(AST_SUB, $1, $3); }
+  | expression DIVIDEDBY expression { $$ = ast_binary(AST_DIV, $1, $3); }
+  | INTEGER { $$ = ast_integer(*$1); delete $1; }
+  | IDENTIFIER { $$ = ast_variable(*$1); delete $1; }
   ;
 
 %%
 
+/*
+ * Built with -DPRATT_CHECK, the driver below is left out, and parser-pratt.c
+ * provides a main() that checks the two parsers against each other instead.
+ */
+#ifndef PRATT_CHECK
+
+/*
+ * Parses text as the whole program, replacing the one parsed before.
+ */
+static int parse_string(const std::string& text) {
+  FILE* input = fmemopen((void*)text.data(), text.size(), "r");
+  ast_reset();
+  restart_scanner(input);
+  int status = yyparse();
+  fclose(input);
+  return status;
+}
+
+/*
+ * Regression checks for programs too big to keep in the repository: every
+ * pass over the tree has to cope with expressions nested hundreds of
+ * thousands of levels deep (a chain of additions is as deep as it is long)
+ * without running out of stack.
+ */
+static int check_deep_programs() {
+  const int terms = 300000;
+  std::string sum = "b";
+  for (int i = 0; i < terms; i++) {
+    sum += " + b";
+  }
+  if (parse_string("b = 1\nc = a + " + sum + "\nx = " + sum + "\n") != 0) {
+    std::cerr << "Error: can't parse the deep program" << std::endl;
+    return 1;
+  }
+
+  // Unoptimized, the translation is the program itself.
+  std::ostringstream cpp;
+  emit_cpp(program, cpp);
+  if (cpp.str() != "int b = 1;\nint c = a + " + sum + ";\nint x = " + sum + ";\n") {
+    std::cerr << "Error: the deep program wasn't translated to C++ correctly" << std::endl;
+    return 1;
+  }
+#ifdef EMIT_LLVM
+  // build_llvm_module() verifies the module it builds.
+  LLVMContextRef context = LLVMContextCreate();
+  LLVMDisposeModule(build_llvm_module(program, context));
+  LLVMContextDispose(context);
+#endif
+  bytecode code = compile_bytecode(program);
+  std::vector<int32_t> registers(code.num_registers);
+  if (!run_bytecode(code, registers.data()) || registers[program.symbol_ids["c"]] != terms + 1
+      || registers[program.symbol_ids["x"]] != terms + 1) {
+    std::cerr << "Error: the deep program didn't run correctly" << std::endl;
+    return 1;
+  }
+
+  // a is never assigned, so c can't be folded, but x can.
+  ast_optimize();
+  int32_t x = program.stmt_value.back();
+  if (program.num_statements() != 3 || program.op[x] != AST_INTEGER
+      || program.literal_values[program.value[x]] != terms + 1) {
+    std::cerr << "Error: the deep program wasn't optimized correctly" << std::endl;
+    return 1;
+  }
+  std::cerr << "Deep expressions: ok" << std::endl;
+  return 0;
+}
+
+#ifdef EMIT_LLVM
+/*
+ * Checks that the tiered engine's compiled code divides like the
+ * interpreter: INT_MIN / -1 is INT_MIN, and dividing by zero fails the run
+ * instead of crashing.  The program runs in the interpreter until the
+ * background compile has finished.
+ */
+static int check_tiered_division() {
+  parse_string("c = a / b\n");
+  int32_t a = program.symbol_ids["a"], b = program.symbol_ids["b"], c = program.symbol_ids["c"];
+  tiered_program* tiered = tiered_create(program, 10);
+  std::vector<int32_t> vars(program.num_symbols());
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+  bool wraps = true;
+  for (int runs = 0; ; runs++) {
+    bool compiled = tiered_is_compiled(tiered);
+    vars[a] = INT_MIN;
+    vars[b] = -1;
+    wraps = tiered_run(tiered, vars.data()) && vars[c] == INT_MIN && wraps;
+    if (compiled || std::chrono::steady_clock::now() > deadline) {
+      break;
+    }
+    if (runs > 10) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  bool compiled = tiered_is_compiled(tiered);
+  vars[b] = 0;
+  bool divides_by_zero = !tiered_run(tiered, vars.data());
+  tiered_destroy(tiered);
+
+  if (!compiled || !wraps || !divides_by_zero) {
+    std::cerr << "Error: " << (!compiled ? "the program wasn't compiled"
+        : !wraps ? "INT_MIN / -1 isn't INT_MIN" : "division by zero wasn't reported") << std::endl;
+    return 1;
+  }
+  std::cerr << "Tiered division: ok" << std::endl;
+  return 0;
+}
+#endif
+
+#ifdef EMIT_LLVM
+/*
+ * Runs a tiny program like source.py and a large generated one with both of
+ * the tiered engine's tiers, and compares them (see tiered_compare()).  The
+ * programs read their variables before assigning them, so their results
+ * depend on the inputs they are run with, which neither ast_optimize() nor
+ * LLVM can see.  They aren't optimized first, so both tiers run every
+ * statement.
+ */
+static int compare_tiers() {
+  const int sizes[] = { 4, 20000 };
+  bool same = true;
+  for (int size : sizes) {
+    std::string text;
+    for (int i = 0; i < size; i++) {
+      text += std::string(1, 'a' + i % 26) + " = " + std::string(1, 'a' + (i + 7) % 26) + " * 3 + ("
+        + std::string(1, 'a' + (i + 13) % 26) + " - " + std::to_string(i % 100) + ") / 7\n";
+    }
+    parse_string(text);
+    std::vector<int32_t> inputs(program.num_symbols());
+    for (size_t symbol = 0; symbol < inputs.size(); symbol++) {
+      inputs[symbol] = 1000 + 37 * symbol;
+    }
+    same = tiered_compare(size < 100 ? "tiny" : "large", program, inputs) && same;
+  }
+  return same ? 0 : 1;
+}
+#endif
+
 int main(int argc, char **argv)
 {
-  yyparse();
-  return 0;
+#ifdef EMIT_LLVM
+  bool llvm = false;
+  long repeat = 0;
+#endif
+  bool optimize = true;
+  bool run = false;
+  bool pratt = false;
+  bool timing = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--no-optimize") == 0) {
+      optimize = false;
+    } else if (strcmp(argv[i], "--run") == 0) {
+      run = true;
+    } else if (strcmp(argv[i], "--pratt") == 0) {
+      pratt = true;
+    } else if (strcmp(argv[i], "--time") == 0) {
+      timing = true;
+    } else if (strcmp(argv[i], "--check") == 0) {
+#ifdef EMIT_LLVM
+      if (check_tiered_division() != 0) {
+        return 1;
+      }
+#endif
+      return check_deep_programs();
+#ifdef EMIT_LLVM
+    } else if (strcmp(argv[i], "--llvm") == 0) {
+      llvm = true;
+    } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+      repeat = strtol(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+      return serve(argv[++i]);
+    } else if (strcmp(argv[i], "-b") == 0) {
+      return compare_tiers();
+#endif
+    }
+  }
+
+  /*
+   * The program can be parsed either by the parser bison generates from this
+   * file or by the hand-written one in parser-pratt.c.  With --time, we report
+   * how long parsing took, to compare the two.
+   */
+  auto start = std::chrono::steady_clock::now();
+  int status = pratt ? pratt_parse() : yyparse();
+  if (timing) {
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    std::cerr << "Parsed in " << elapsed.count() << " us (status " << status << ")" << std::endl;
+  }
+  std::cerr << skipped_statements << " statement(s) skipped" << std::endl;
+
+  /*
+   * Whatever could be parsed is still translated, but the exit status tells
+   * the caller that some of the input was bad.
+   */
+  int exit_status = status != 0 || skipped_statements > 0;
+
+  if (optimize) {
+    ast_optimize();
+  }
+
+  /*
+   * Instead of translating the program, we can run it right away with the
+   * bytecode interpreter and print the final value of each variable.
+   */
+#ifdef EMIT_LLVM
+  /*
+   * Running the program many times goes through the tiered engine, which
+   * compiles it with LLVM once it has run often enough.
+   */
+  if (repeat > 0) {
+    tiered_program* tiered = tiered_create(program, 1000);
+    std::vector<int32_t> vars(program.num_symbols());
+    for (long i = 0; i < repeat; i++) {
+      // Every run starts with all of the variables at 0.
+      std::fill(vars.begin(), vars.end(), 0);
+      if (!tiered_run(tiered, vars.data())) {
+        std::cerr << "Error: division by zero" << std::endl;
+        return 1;
+      }
+    }
+    std::cerr << "Ran " << repeat << " time(s), "
+              << (tiered_is_compiled(tiered) ? "compiled" : "interpreted") << " at the end" << std::endl;
+    tiered_destroy(tiered);
+    for (size_t symbol = 0; symbol < program.num_symbols(); symbol++) {
+      std::cout << program.symbol_names[symbol] << " = " << vars[symbol] << std::endl;
+    }
+    return exit_status;
+  }
+#endif
+
+  if (run) {
+    // A variable that is read before it's assigned reads as 0.
+    bytecode code = compile_bytecode(program);
+    std::vector<int32_t> registers(code.num_registers);
+    if (!run_bytecode(code, registers.data())) {
+      std::cerr << "Error: division by zero" << std::endl;
+      return 1;
+    }
+    for (size_t symbol = 0; symbol < program.num_symbols(); symbol++) {
+      std::cout << program.symbol_names[symbol] << " = " << registers[symbol] << std::endl;
+    }
+    return exit_status;
+  }
+
+#ifdef EMIT_LLVM
+  if (llvm) {
+    emit_llvm(program, std::cout);
+    return exit_status;
+  }
+#endif
+  emit_cpp(program, std::cout);
+  return exit_status;
 }
+#endif
 
 void yyerror(const char *s) {
-    printf("Error: %s\n", s);
+    std::cerr << "Error: " << s << std::endl;
 }
 
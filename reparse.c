@@ -0,0 +1,362 @@
+/*
+ * Incremental reparsing; see reparse.h.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include "parser-push.h"
+#include "reparse.h"
+
+#define NO_CHECKPOINT SIZE_MAX
+
+/*
+ * The state of the scan that is running, which line_boundary() works on.
+ * While reparsing, the checkpoints and declarations from before the edit are
+ * kept on the side, to look for a checkpoint to converge with.
+ */
+static incremental_parse* current = NULL;
+static size_t scan_start;         // Offset in the text where the scan started
+static size_t output_start;       // Lines translated before it
+static size_t seen_statements;    // Statements ended when the last line did
+
+static std::vector<parse_checkpoint> old_checkpoints;
+static std::vector<std::string> old_declared;
+static size_t old_edit_end;       // End of the edit in the old text
+static size_t edit_end;           // ...and in the new text
+static size_t resume_symbols;     // Symbols declared where the scan started
+static size_t converged;          // Old checkpoint the scan stopped at
+
+static bool before(size_t offset, const parse_checkpoint& checkpoint) {
+    return offset < checkpoint.offset;
+}
+
+/*
+ * The symbols declared before the scan started are the same as before the
+ * edit, so only the ones declared since then need to be compared.
+ */
+static bool same_symbols(const parse_checkpoint& old) {
+    return declared.size() == old.symbols
+        && std::is_permutation(declared.begin() + resume_symbols, declared.end(),
+                               old_declared.begin() + resume_symbols);
+}
+
+bool line_boundary(size_t scanned, int line, const int* indents, int depth) {
+    // A NEWLINE that doesn't end a statement isn't a place to resume from.
+    if (statements_ended == seen_statements) {
+        return true;
+    }
+    seen_statements = statements_ended;
+
+    parse_checkpoint checkpoint;
+    checkpoint.offset = scan_start + scanned;
+    checkpoint.line = line;
+    checkpoint.output_lines = output_start + output->size();
+    checkpoint.symbols = declared.size();
+    checkpoint.indents.assign(indents, indents + depth);
+
+    if (!old_checkpoints.empty() && checkpoint.offset >= edit_end) {
+        size_t old_offset = old_edit_end + (checkpoint.offset - edit_end);
+        auto old = std::upper_bound(old_checkpoints.begin(), old_checkpoints.end(), old_offset, before) - 1;
+        if (old->offset == old_offset && old->indents == checkpoint.indents && same_symbols(*old)) {
+            converged = old - old_checkpoints.begin();
+            current->checkpoints.push_back(std::move(checkpoint));
+            return false;
+        }
+    }
+    current->checkpoints.push_back(std::move(checkpoint));
+    return true;
+}
+
+/*
+ * Parses the text from checkpoint from, translating into lines.
+ */
+static void scan_from(incremental_parse* parse, const parse_checkpoint& from, std::vector<std::string>* lines) {
+    current = parse;
+    output = lines;
+    scan_start = from.offset;
+    output_start = from.output_lines;
+    seen_statements = statements_ended;
+    converged = NO_CHECKPOINT;
+    scan_lines(parse->text.data() + from.offset, parse->text.size() - from.offset, from.line, from.indents);
+    output = NULL;
+    current = NULL;
+}
+
+void parse_text(incremental_parse* parse, const std::string& text) {
+    parse->text = text;
+    parse->output.clear();
+    parse->checkpoints.assign(1, parse_checkpoint{ 0, 1, 0, 0, { 0 } });
+    old_checkpoints.clear();
+    declared.clear();
+    symbols.clear();
+    scan_from(parse, parse->checkpoints[0], &parse->output);
+    parse->declared = declared;
+}
+
+/*
+ * A new parser can't be given an empty input, so a scan that would only
+ * find blank lines is skipped.
+ */
+static bool only_blank_lines(const std::string& text, size_t offset) {
+    size_t line_start = offset;
+    for (size_t i = offset; i < text.size(); i++) {
+        if (text[i] == '\n') {
+            line_start = i + 1;
+        } else if (text[i] != ' ' && text[i] != '\t' && text[i] != '\r') {
+            return false;
+        }
+    }
+    return line_start == text.size();
+}
+
+reparse_stats reparse(incremental_parse* parse, size_t start, size_t end, const std::string& replacement) {
+    // Nothing before the last checkpoint at or before the edit has changed,
+    // so parsing resumes there.
+    size_t resume = std::upper_bound(parse->checkpoints.begin(), parse->checkpoints.end(), start, before)
+        - parse->checkpoints.begin() - 1;
+    old_checkpoints.swap(parse->checkpoints);
+    parse->checkpoints.assign(old_checkpoints.begin(), old_checkpoints.begin() + resume + 1);
+    const parse_checkpoint& from = old_checkpoints[resume];
+
+    old_declared.swap(parse->declared);
+    declared.assign(old_declared.begin(), old_declared.begin() + from.symbols);
+    symbols = std::set<std::string>(declared.begin(), declared.end());
+    resume_symbols = from.symbols;
+
+    parse->text.replace(start, end - start, replacement);
+    old_edit_end = end;
+    edit_end = start + replacement.size();
+
+    std::vector<std::string> lines;
+    size_t statements = statements_ended;
+    converged = NO_CHECKPOINT;
+    if (from.offset == 0 || !only_blank_lines(parse->text, from.offset)) {
+        scan_from(parse, from, &lines);
+    }
+
+    reparse_stats stats;
+    stats.statements = statements_ended - statements;
+    stats.first_line = from.output_lines;
+    stats.added_lines = lines.size();
+    size_t old_lines_end = parse->output.size();
+    if (converged != NO_CHECKPOINT) {
+        // The rest of the old parse still holds, only moved.
+        const parse_checkpoint& old = old_checkpoints[converged];
+        parse_checkpoint now = parse->checkpoints.back();
+        for (size_t c = converged + 1; c < old_checkpoints.size(); c++) {
+            parse_checkpoint& checkpoint = old_checkpoints[c];
+            checkpoint.offset = checkpoint.offset - old.offset + now.offset;
+            checkpoint.line = checkpoint.line - old.line + now.line;
+            checkpoint.output_lines = checkpoint.output_lines - old.output_lines + now.output_lines;
+            parse->checkpoints.push_back(std::move(checkpoint));
+        }
+        declared.insert(declared.end(), old_declared.begin() + old.symbols, old_declared.end());
+        old_lines_end = old.output_lines;
+    }
+    stats.removed_lines = old_lines_end - stats.first_line;
+
+    parse->output.erase(parse->output.begin() + stats.first_line, parse->output.begin() + old_lines_end);
+    parse->output.insert(parse->output.begin() + stats.first_line, lines.begin(), lines.end());
+    parse->declared = declared;
+    old_checkpoints.clear();
+    old_declared.clear();
+    return stats;
+}
+
+static bool read_file(const char* path, std::string& text) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        perror(path);
+        return false;
+    }
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    text = contents.str();
+    return true;
+}
+
+/*
+ * Parses text from scratch, with the parser's messages thrown away.
+ */
+static void parse_quietly(incremental_parse* parse, const std::string& text) {
+    std::ostringstream messages;
+    std::streambuf* cerr_buffer = std::cerr.rdbuf(messages.rdbuf());
+    parse_text(parse, text);
+    std::cerr.rdbuf(cerr_buffer);
+}
+
+/*
+ * Parses the text of parse from scratch, with the parser's messages thrown
+ * away, and reports under name where the translation or the checkpoints
+ * differ from parse's.
+ */
+static bool same_as_full_parse(const incremental_parse& parse, const std::string& name) {
+    incremental_parse full;
+    parse_quietly(&full, parse.text);
+
+    for (size_t i = 0; i < parse.output.size() || i < full.output.size(); i++) {
+        if (i == parse.output.size() || i == full.output.size() || parse.output[i] != full.output[i]) {
+            std::cerr << name << ": translated line " << i + 1 << " is \""
+                << (i < parse.output.size() ? parse.output[i] : "(none)") << "\" after reparsing, but \""
+                << (i < full.output.size() ? full.output[i] : "(none)") << "\" after a full parse" << std::endl;
+            return false;
+        }
+    }
+    for (size_t i = 0; i < parse.checkpoints.size() || i < full.checkpoints.size(); i++) {
+        if (i == parse.checkpoints.size() || i == full.checkpoints.size()) {
+            std::cerr << name << ": " << parse.checkpoints.size() << " checkpoint(s) after reparsing, but "
+                << full.checkpoints.size() << " after a full parse" << std::endl;
+            return false;
+        }
+        const parse_checkpoint& a = parse.checkpoints[i];
+        const parse_checkpoint& b = full.checkpoints[i];
+        if (a.offset != b.offset || a.line != b.line || a.output_lines != b.output_lines
+                || a.symbols != b.symbols || a.indents != b.indents) {
+            std::cerr << name << ": checkpoint " << i << " is at offset " << a.offset << " (line " << a.line
+                << ") after reparsing, but at offset " << b.offset << " (line " << b.line
+                << ") after a full parse, or differs in its state" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Applies the difference between the text of parse and new_text as one edit,
+ * the way reparse_files() does, and returns its stats.
+ */
+static reparse_stats reparse_text(incremental_parse* parse, const std::string& new_text) {
+    // The edit is whatever is between the longest common prefix and suffix
+    // of the two texts.
+    const std::string& old_text = parse->text;
+    size_t start = 0;
+    while (start < old_text.size() && start < new_text.size() && old_text[start] == new_text[start]) {
+        start++;
+    }
+    size_t old_end = old_text.size();
+    size_t new_end = new_text.size();
+    while (old_end > start && new_end > start && old_text[old_end - 1] == new_text[new_end - 1]) {
+        old_end--;
+        new_end--;
+    }
+    return reparse(parse, start, old_end, new_text.substr(start, new_end - start));
+}
+
+/*
+ * Reparses parse as new_text, with the parser's messages thrown away, and
+ * checks the result against a full parse of new_text.
+ */
+static bool check_edit(incremental_parse* parse, const std::string& new_text, const std::string& name) {
+    std::ostringstream messages;
+    std::streambuf* cerr_buffer = std::cerr.rdbuf(messages.rdbuf());
+    reparse_text(parse, new_text);
+    std::cerr.rdbuf(cerr_buffer);
+    return same_as_full_parse(*parse, name);
+}
+
+/*
+ * A random program with blocks up to four levels deep, blank and
+ * whitespace-only lines, the odd syntax or indentation error, and sometimes
+ * no newline at the end.
+ */
+static std::string random_program(std::mt19937& random) {
+    static const char* expressions[] = { "1", "a", "b + 1", "c * (a - 2)", "x / y", "(a", "a +", "$" };
+    std::string text;
+    int depth = 0;
+    for (int lines = random() % 30; lines > 0; lines--) {
+        switch (random() % 10) {
+        case 0:
+            text += "\n";
+            continue;
+        case 1:
+            text += std::string(random() % 5, ' ') + "\n";
+            continue;
+        case 2:
+            depth = std::min(depth + 1, 4);
+            break;
+        case 3:
+        case 4:
+            depth = random() % (depth + 1);
+            break;
+        }
+        int indent = 2 * depth + (random() % 20 == 0);
+        text += std::string(indent, ' ') + "abcxy"[random() % 5] + " = "
+            + expressions[random() % (sizeof(expressions) / sizeof(expressions[0]))] + "\n";
+    }
+    if (random() % 5 == 0 && !text.empty()) {
+        text.pop_back();
+    }
+    return text;
+}
+
+/*
+ * Replaces a random stretch of text, of up to a line or so, with a random
+ * piece of a program.
+ */
+static std::string random_edit(std::mt19937& random, const std::string& text) {
+    static const char* pieces[] = { "", "\n", "\n\n", "   \n", "  ", "a = 1\n", "  z = a\n", "b", " + 2", "(", "=" };
+    size_t start = random() % (text.size() + 1);
+    size_t end = std::min(text.size(), start + random() % 12);
+    return text.substr(0, start) + pieces[random() % (sizeof(pieces) / sizeof(pieces[0]))] + text.substr(end);
+}
+
+int check_reparse() {
+    // Edits inside blocks, edits that remove a declaration that later
+    // statements use, and texts that end in blank lines.
+    static const struct { const char* old_text; const char* new_text; } cases[] = {
+        { "a = 1\n  b = a\n  c = b\n    d = c\n  e = d\nf = e\n", "a = 1\n  b = 2\n  c = b\n    d = c\n  e = d\nf = e\n" },
+        { "a = 1\n  b = a\n  c = b\n    d = c\n  e = d\nf = e\n", "a = 1\n  b = a\n  c = b\n    d = c + 1\n  e = d\nf = e\n" },
+        { "a = 1\n  b = a\n  c = b\n    d = c\n  e = d\nf = e\n", "a = 1\n  b = a\n  x = 3\n  c = b\n    d = c\n  e = d\nf = e\n" },
+        { "a = 1\n  b = a\n  c = b\n    d = c\n  e = d\nf = e\n", "a = 1\n  b = a\n  c = b\n  d = c\n  e = d\nf = e\n" },
+        { "a = 1\n  b = a\n  c = b\n    d = c\n  e = d\nf = e\n", "a = 1\n  b = a\n  c = b\n   d = c\n  e = d\nf = e\n" },
+        { "a = 1\nb = a\na = 2\nc = a\n", "b = a\na = 2\nc = a\n" },
+        { "a = 1\nb = a\na = 2\nc = a\n", "a = 1\nb = a\nc = a\n" },
+        { "x = 1\n  a = 1\n  b = a\na = 2\n", "x = 1\n  b = a\na = 2\n" },
+        { "a = 1\nb = 2\n", "a = 1\nb = 2\n\n  \n" },
+        { "a = 1\nb = 2\n\n  \n", "a = 1\n\n  \n" },
+        { "a = 1\n  b = 2\n\n\n", "a = 1\n  b = 2\n\n   \n\n" },
+        { "a = 1\n  b = 2\n\n\n", "a = 1\n\n\n" },
+    };
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        incremental_parse parse;
+        parse_quietly(&parse, cases[i].old_text);
+        failed += !check_edit(&parse, cases[i].new_text, "case " + std::to_string(i + 1));
+    }
+
+    // Chains of random edits, each one reparsed from where the last left off.
+    std::mt19937 random(1);
+    for (int round = 0; round < 500 && !failed; round++) {
+        incremental_parse parse;
+        parse_quietly(&parse, random_program(random));
+        for (int edit = 0; edit < 20 && !failed; edit++) {
+            std::string name = "random edit " + std::to_string(round) + "." + std::to_string(edit);
+            failed += !check_edit(&parse, random_edit(random, parse.text), name);
+        }
+    }
+    printf("%s\n", failed ? "FAILED" : "ok");
+    return failed ? 1 : 0;
+}
+
+int reparse_files(const char* old_path, const char* new_path) {
+    std::string old_text, new_text;
+    if (!read_file(old_path, old_text) || !read_file(new_path, new_text)) {
+        return 1;
+    }
+
+    incremental_parse parse;
+    parse_text(&parse, old_text);
+    reparse_stats stats = reparse_text(&parse, new_text);
+    for (const std::string& line : parse.output) {
+        std::cout << line << "\n";
+    }
+    std::cout.flush();
+    std::cerr << "Reparsed " << stats.statements << " statement(s), replacing " << stats.removed_lines
+        << " line(s) after line " << stats.first_line << " with " << stats.added_lines << std::endl;
+    return same_as_full_parse(parse, new_path) ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+/*
+ * Incremental reparsing for parser-push.y.
+ *
+ * Every statement ends at a NEWLINE, and once the parser has reduced it, its
+ * stack holds nothing but the input parsed so far.  So at the start of each
+ * statement's line, parsing can be picked up again from a small checkpoint:
+ * where the line starts, its line number, the scanner's open indentation
+ * levels (its start condition is always LINE_START there), and how many
+ * symbols have been declared, which is the symbol table's version, since it
+ * only ever grows.  The parser itself doesn't have to be saved: a new
+ * yypstate that is given the rest of the input parses it exactly like the
+ * old one would have.
+ *
+ * After an edit, parsing resumes from the last checkpoint before it, and
+ * stops at the first statement boundary after it where the state is the same
+ * as at one of the old checkpoints.  From there on, the old translation is
+ * still right, so only the lines in between are replaced.
+ *
+ * This needs scanner-push.l and parser-push.y to be built with -DREPARSE:
+ *
+ *   bison -d -o parser-push.c parser-push.y
+ *   flex -o scanner-push.c scanner-push.l
+ *   g++ -DREPARSE parser-push.c scanner-push.c reparse.c -o parser-push
+ *   ./parser-push --reparse old.py new.py
+ *   ./parser-push --check
+ */
+
+#ifndef REPARSE_H
+#define REPARSE_H
+
+#include <cstddef>
+#include <set>
+#include <string>
+#include <vector>
+
+struct parse_checkpoint {
+    size_t offset;              // Where the line starts in the text
+    int line;                   // Its line number
+    size_t output_lines;        // Lines translated before it
+    size_t symbols;             // Symbols declared before it
+    std::vector<int> indents;   // The scanner's open indentation levels
+};
+
+struct incremental_parse {
+    std::string text;
+    std::vector<std::string> output;            // One line per statement
+    std::vector<parse_checkpoint> checkpoints;  // In text order
+    std::vector<std::string> declared;          // In order of declaration
+};
+
+struct reparse_stats {
+    size_t statements;      // Statements that were parsed again
+    size_t first_line;      // First translated line that was replaced
+    size_t removed_lines;   // How many were replaced
+    size_t added_lines;     // ...and by how many new ones
+};
+
+/*
+ * Parses text from scratch, with a checkpoint at every statement.
+ */
+void parse_text(incremental_parse* parse, const std::string& text);
+
+/*
+ * Replaces bytes [start, end) of the text with replacement, and updates the
+ * translation and the checkpoints to match.
+ */
+reparse_stats reparse(incremental_parse* parse, size_t start, size_t end, const std::string& replacement);
+
+/*
+ * Translates the file at old_path, then applies the difference between it
+ * and the file at new_path as one edit, and prints the new translation.
+ * Fails if that translation differs from a full parse of new_path.
+ */
+int reparse_files(const char* old_path, const char* new_path);
+
+/*
+ * Checks reparsing against full parses, after edits inside blocks, edits
+ * that remove a declaration, edits that leave only blank lines at the end,
+ * and chains of random edits.  Prints "ok" or "FAILED".
+ */
+int check_reparse();
+
+/*
+ * Shared with parser-push.y, which translates into output (instead of to
+ * std::cout) when it's set, and counts the statements it has ended.
+ */
+extern std::vector<std::string>* output;
+extern std::vector<std::string> declared;
+extern std::set<std::string> symbols;
+extern size_t statements_ended;
+
+/*
+ * Shared with scanner-push.l.  scan_lines() scans and parses text, which
+ * starts at the beginning of the given line, and calls line_boundary() with
+ * how much of the text it has scanned after each NEWLINE.  It stops early if
+ * line_boundary() returns false, and then returns YYPUSH_MORE; otherwise, it
+ * returns the parser's final status.
+ */
+int scan_lines(const char* text, size_t length, int line, const std::vector<int>& indents);
+bool line_boundary(size_t scanned, int line, const int* indents, int depth);
+
+#endif
@@ -0,0 +1,244 @@
+/*
+ * The rules in rules.l, run behind a prefilter.
+ *
+ * In rules.l, the only rules whose actions do anything are "cat|dog" and
+ * "ca*t", and every match for those starts with a 'c' or a 'd'.  (The final
+ * "." rule can never win, since "[^0-9]" and "[0-9]" match the same single
+ * characters and come first.)  Input without those bytes is therefore matched
+ * and thrown away without any visible effect, so instead of feeding every
+ * byte through the DFA, main() below searches for the candidate bytes 16 at a
+ * time with SSE2 and only runs yylex() on the lines that contain one.
+ *
+ * Lines are safe places to stop and restart the DFA: the only match that
+ * crosses the start of a line is "cat\n\r", so a line that starts with '\r'
+ * is kept together with the line before it.  A restarted scanner is at the
+ * beginning of a line, just like the original one, so "^cat" still works, and
+ * yylineno is advanced past the skipped lines by counting their newlines.
+ *
+ * The scanner itself is the one flex generates from rules.l, included below,
+ * so the rules only exist in one place.  What can't be shared is the analysis
+ * above: if you add a rule with a visible action, add its possible first
+ * characters to candidate_bytes.  Running with --check scans the input both
+ * ways and fails if the output differs, which catches a candidate_bytes that
+ * no longer matches the rules:
+ *
+ *   flex -o rules.c rules.l
+ *   gcc -O2 rules-prefilter.c -o rules-prefilter
+ *   ./rules-prefilter --check < input.txt
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * rules.l's actions call foo() before its definition, and its main() is
+ * replaced by the one below.
+ */
+void foo();
+#define main rules_main
+#include "rules.c"
+#undef main
+
+static const char candidate_bytes[] = "cd";
+
+/*
+ * Returns the first byte in [p, end) that some rule with a visible action
+ * could start with, or end if there is none.
+ */
+static const char* find_candidate(const char* p, const char* end) {
+#ifdef __SSE2__
+  int n = strlen(candidate_bytes);
+  __m128i needles[sizeof(candidate_bytes)];
+  for (int i = 0; i < n; i++) {
+    needles[i] = _mm_set1_epi8(candidate_bytes[i]);
+  }
+  for (; end - p >= 16; p += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i*)p);
+    __m128i matches = _mm_setzero_si128();
+    for (int i = 0; i < n; i++) {
+      matches = _mm_or_si128(matches, _mm_cmpeq_epi8(block, needles[i]));
+    }
+    int mask = _mm_movemask_epi8(matches);
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for (; p < end; p++) {
+    if (*p && strchr(candidate_bytes, *p)) {
+      return p;
+    }
+  }
+  return end;
+}
+
+static int count_newlines(const char* p, const char* end) {
+  int count = 0;
+#ifdef __SSE2__
+  __m128i newline = _mm_set1_epi8('\n');
+  for (; end - p >= 16; p += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i*)p);
+    count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline)));
+  }
+#endif
+  for (; p < end; p++) {
+    count += *p == '\n';
+  }
+  return count;
+}
+
+/*
+ * A line ends at a newline that isn't followed by '\r' (see above).  These
+ * find the start of the line containing p and the end of the line containing
+ * p, never going outside of [start, end).
+ */
+static const char* line_start(const char* start, const char* p) {
+  while (p > start && !(p[-1] == '\n' && p[0] != '\r')) {
+    p--;
+  }
+  return p;
+}
+
+static const char* line_end(const char* p, const char* end) {
+  while ((p = memchr(p, '\n', end - p)) != NULL) {
+    p++;
+    if (p == end || *p != '\r') {
+      return p;
+    }
+  }
+  return end;
+}
+
+/*
+ * Runs the rules over the lines in [p, end) that contain a candidate byte.
+ * p must be at the start of a line.
+ */
+static void scan(const char* p, const char* end) {
+  while (p < end) {
+    const char* candidate = find_candidate(p, end);
+    if (candidate == end) {
+      yylineno += count_newlines(p, end);
+      return;
+    }
+
+    const char* start = line_start(p, candidate);
+    yylineno += count_newlines(p, start);
+
+    // Lines with candidates that directly follow each other are scanned
+    // together, with a single call to yylex().
+    const char* stop = line_end(candidate, end);
+    while (stop < end) {
+      candidate = find_candidate(stop, end);
+      if (candidate == end || line_start(stop, candidate) != stop) {
+        break;
+      }
+      stop = line_end(candidate, end);
+    }
+
+    YY_BUFFER_STATE buffer = yy_scan_bytes(start, stop - start);
+    yylex();
+    yy_delete_buffer(buffer);
+    p = stop;
+  }
+}
+
+/*
+ * Scans input with the plain scanner and then with the prefilter, and
+ * returns whether both wrote the same output.
+ */
+static int same_output(const char* input, size_t size) {
+  FILE* outputs[2];
+  fflush(stdout);
+  int saved_stdout = dup(STDOUT_FILENO);
+  for (int filtered = 0; filtered <= 1; filtered++) {
+    outputs[filtered] = tmpfile();
+    dup2(fileno(outputs[filtered]), STDOUT_FILENO);
+    yylineno = 1;
+    if (filtered) {
+      scan(input, input + size);
+    } else {
+      YY_BUFFER_STATE buffer = yy_scan_bytes(input, size);
+      yylex();
+      yy_delete_buffer(buffer);
+    }
+    fflush(stdout);
+  }
+  dup2(saved_stdout, STDOUT_FILENO);
+  close(saved_stdout);
+
+  rewind(outputs[0]);
+  rewind(outputs[1]);
+  int a, b;
+  do {
+    a = getc(outputs[0]);
+    b = getc(outputs[1]);
+  } while (a == b && a != EOF);
+  fclose(outputs[0]);
+  fclose(outputs[1]);
+  return a == b;
+}
+
+int main(int argc, char** argv) {
+  int check = argc > 1 && strcmp(argv[1], "--check") == 0;
+  size_t capacity = 1 << 20;
+  size_t size = 0;
+  char* input = malloc(capacity);
+
+  for (;;) {
+    if (size == capacity) {
+      capacity *= 2;
+      input = realloc(input, capacity);
+    }
+    ssize_t n = read(STDIN_FILENO, input + size, capacity - size);
+    int at_eof = n <= 0;
+    if (!at_eof) {
+      size += n;
+    }
+
+    // The check needs the whole input at once.
+    if (check) {
+      if (at_eof) {
+        break;
+      }
+      continue;
+    }
+
+    // Only complete lines can be scanned, the rest waits for more input.
+    // A trailing newline isn't the end of a line yet, since the next byte
+    // could still be a '\r'.
+    const char* end = input + size;
+    if (!at_eof) {
+      end = input;
+      for (const char* p = input + size - 1; p > input; p--) {
+        if (p[-1] == '\n' && p[0] != '\r') {
+          end = p;
+          break;
+        }
+      }
+    }
+
+    scan(input, end);
+    size -= end - input;
+    memmove(input, end, size);
+
+    if (at_eof) {
+      break;
+    }
+  }
+
+  if (check) {
+    int same = same_output(input, size);
+    fprintf(stderr, "%s\n", same ? "ok" : "prefilter output differs; is candidate_bytes up to date with rules.l?");
+    free(input);
+    return same ? 0 : 1;
+  }
+
+  free(input);
+  return 0;
+}
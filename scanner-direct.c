@@ -0,0 +1,515 @@
+/*
+ * Hand-written scanner for the same tokens as scanner.l.
+ *
+ * This is a drop-in replacement for the flex-generated scanner: it provides
+ * the same yylex() and sets yylval the same way, so parser.y doesn't change.
+ * Instead of walking a DFA table one byte at a time, it dispatches on a
+ * 256-entry character class table and then runs a small loop that is
+ * specialized for that kind of token.  Lexemes are copied straight from the
+ * input buffer into yylval, without going through yytext first.
+ *
+ * Build it in place of scanner.c:
+ *
+ *   bison -d -o parser.c parser.y
+ *   g++ parser.c scanner-direct.c ast.c bytecode.c parser-pratt.c -o parser
+ *
+ * Built with -DSCANNER_CHECK instead, together with the flex-generated
+ * scanner, it becomes a program that runs both scanners over the same input
+ * to check that they return the same tokens on the same lines, and to compare
+ * their speed:
+ *
+ *   flex -o scanner.c scanner.l
+ *   g++ -O2 -DSCANNER_CHECK scanner.c scanner-direct.c -o scanner-check
+ *   ./scanner-check                 # random inputs
+ *   ./scanner-check source.py       # the given files
+ *   ./scanner-check -b [big.py]     # throughput of both scanners
+ */
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+/*
+ * When checking, the flex scanner keeps the usual names, and this one gets
+ * its own.
+ */
+#ifdef SCANNER_CHECK
+#define yylex direct_yylex
+#define yylineno direct_yylineno
+#define restart_scanner direct_restart_scanner
+#define finished_line direct_finished_line
+#endif
+
+#include "parser.h"
+#include "keywords.h"
+
+enum char_class : unsigned char {
+    CLASS_OTHER,
+    CLASS_SPACE,     // ' ', '\t' and '\r' are all skipped
+    CLASS_NEWLINE,
+    CLASS_LETTER,    // Letters and '_', which can start an identifier
+    CLASS_DIGIT,
+    CLASS_PUNCT,     // Single-character tokens, see punct_token[]
+    CLASS_END        // The '\0' sentinel after the buffered input
+};
+
+struct char_tables {
+    unsigned char char_class[256];
+    bool identifier_char[256];
+    int punct_token[256];
+};
+
+constexpr char_tables build_tables() {
+    char_tables tables = {};
+    tables.char_class[' '] = CLASS_SPACE;
+    tables.char_class['\t'] = CLASS_SPACE;
+    tables.char_class['\r'] = CLASS_SPACE;
+    tables.char_class['\n'] = CLASS_NEWLINE;
+    for (int c = 'a'; c <= 'z'; c++) {
+        tables.char_class[c] = CLASS_LETTER;
+        tables.char_class[c - 'a' + 'A'] = CLASS_LETTER;
+        tables.identifier_char[c] = true;
+        tables.identifier_char[c - 'a' + 'A'] = true;
+    }
+    tables.char_class['_'] = CLASS_LETTER;
+    tables.identifier_char['_'] = true;
+    for (int c = '0'; c <= '9'; c++) {
+        tables.char_class[c] = CLASS_DIGIT;
+        tables.identifier_char[c] = true;
+    }
+
+    const char puncts[] = "=+-*/()";
+    const int tokens[] = { ASSIGN, PLUS, MINUS, TIMES, DIVIDEDBY, LPAREN, RPAREN };
+    for (int i = 0; puncts[i]; i++) {
+        tables.char_class[(unsigned char)puncts[i]] = CLASS_PUNCT;
+        tables.punct_token[(unsigned char)puncts[i]] = tokens[i];
+    }
+
+    tables.char_class[0] = CLASS_END;
+    return tables;
+}
+
+static constexpr char_tables tables = build_tables();
+
+/*
+ * Input is read from stdin (or the file given to restart_scanner()) in large
+ * blocks.  The buffer always has at least 8 zero bytes after the valid input,
+ * so the integer loop below can read a whole word at a time without checking
+ * for the end of the buffer.
+ */
+#define BUFFER_SIZE (1 << 16)
+#define BUFFER_PADDING 8
+
+static char buffer[BUFFER_SIZE + BUFFER_PADDING];
+static char* cursor = buffer;
+static char* limit = buffer;
+static bool at_eof = false;
+static FILE* input = stdin;
+
+int yylineno = 1;
+
+/*
+ * The current line starts at line_start, unless a refill has moved its
+ * beginning into line_prefix.  The text of the last finished line is only
+ * put together when finished_line() asks for it, so it costs nothing for the
+ * lines nobody looks at.
+ */
+static char* line_start = buffer;
+static std::string line_prefix;
+static const char* finished_start = buffer;
+static const char* finished_end = buffer;
+static std::string finished_prefix;
+static std::string last_line;
+
+void restart_scanner(FILE* file) {
+    input = file;
+    cursor = limit = buffer;
+    memset(buffer, 0, BUFFER_PADDING);
+    at_eof = false;
+    yylineno = 1;
+    line_start = buffer;
+    line_prefix.clear();
+    finished_start = finished_end = buffer;
+    finished_prefix.clear();
+}
+
+const std::string& finished_line() {
+    last_line.assign(finished_prefix).append(finished_start, finished_end - finished_start);
+    while (!last_line.empty() && last_line.back() == '\r') {
+        last_line.pop_back();
+    }
+    return last_line;
+}
+
+/*
+ * Ends the current line at end, which is its newline or the end of the input.
+ */
+static void finish_line(char* end) {
+    finished_start = line_start;
+    finished_end = end;
+    if (!line_prefix.empty() || !finished_prefix.empty()) {
+        finished_prefix.swap(line_prefix);
+        line_prefix.clear();
+    }
+}
+
+/*
+ * Returns whether the current line, up to the cursor, has anything but
+ * whitespace in it.
+ */
+static bool line_has_text() {
+    for (const char* p = line_start; p < cursor; p++) {
+        if (tables.char_class[(unsigned char)*p] != CLASS_SPACE) {
+            return true;
+        }
+    }
+    for (char c : line_prefix) {
+        if (tables.char_class[(unsigned char)c] != CLASS_SPACE) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Refills the buffer, keeping the bytes from *keep onward (the part of the
+ * current token that has been scanned so far).  *keep and cursor are updated
+ * to point into the refilled buffer.  Returns the number of new bytes read,
+ * which is 0 at the end of the input.
+ */
+static size_t refill(char** keep) {
+    line_prefix.append(line_start, *keep - line_start);
+    line_start = buffer;
+    size_t kept = limit - *keep;
+    size_t offset = cursor - *keep;
+    memmove(buffer, *keep, kept);
+    *keep = buffer;
+    cursor = buffer + offset;
+    limit = buffer + kept;
+
+    size_t read = 0;
+    if (!at_eof && kept < BUFFER_SIZE) {
+        read = fread(limit, 1, BUFFER_SIZE - kept, input);
+        if (read == 0) {
+            at_eof = true;
+        }
+    }
+    limit += read;
+    memset(limit, 0, BUFFER_PADDING);
+    return read;
+}
+
+/*
+ * Returns the number of leading digit bytes in the 8 bytes at p.  Each byte
+ * is xor-ed with '0', which maps exactly the digits onto 0-9 with a zero high
+ * nibble.  Adding 6 then pushes 10-15 into the high nibble too, so a byte is
+ * a digit iff its high nibble is still zero.  Carries only ever move toward
+ * later bytes, so the first non-digit is always reported correctly.
+ */
+static inline int count_digits(const char* p) {
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    uint64_t t = word ^ 0x3030303030303030ULL;
+    uint64_t non_digits = ((t + 0x0606060606060606ULL) | t) & 0xF0F0F0F0F0F0F0F0ULL;
+    if (non_digits == 0) {
+        return 8;
+    }
+    return __builtin_ctzll(non_digits) / 8;
+#else
+    int n = 0;
+    while (n < 8 && tables.char_class[(unsigned char)p[n]] == CLASS_DIGIT) {
+        n++;
+    }
+    return n;
+#endif
+}
+
+int yylex() {
+    for (;;) {
+        unsigned char c = *cursor;
+        switch (tables.char_class[c]) {
+        case CLASS_SPACE:
+            cursor++;
+            while (tables.char_class[(unsigned char)*cursor] == CLASS_SPACE) {
+                cursor++;
+            }
+            break;
+
+        case CLASS_NEWLINE:
+            // Like scanner.l, a blank line doesn't end a statement, so it
+            // doesn't produce a NEWLINE.
+            if (!line_has_text()) {
+                line_prefix.clear();
+                line_start = ++cursor;
+                yylineno++;
+                break;
+            }
+            finish_line(cursor);
+            line_start = ++cursor;
+            yylineno++;
+            return NEWLINE;
+
+        case CLASS_PUNCT:
+            cursor++;
+            return tables.punct_token[c];
+
+        case CLASS_LETTER: {
+            // Like integers, identifiers may continue in the next block.
+            // Only the first character is known to belong to the
+            // identifier; after a refill, the scan picks up where it
+            // stopped.
+            char* start = cursor++;
+            do {
+                while (tables.identifier_char[(unsigned char)*cursor]) {
+                    cursor++;
+                }
+            } while (cursor == limit && refill(&start) > 0);
+            int keyword = keyword_token(start, cursor - start);
+            if (keyword) {
+                return keyword;
+            }
+            yylval.str = new std::string(start, cursor - start);
+            return IDENTIFIER;
+        }
+
+        case CLASS_DIGIT: {
+            // The zero padding stops the loop at the end of the buffer, in
+            // which case the integer may continue in the next block of input.
+            char* start = cursor;
+            do {
+                int n;
+                do {
+                    n = count_digits(cursor);
+                    cursor += n;
+                } while (n == 8);
+            } while (cursor == limit && refill(&start) > 0);
+            yylval.str = new std::string(start, cursor - start);
+            return INTEGER;
+        }
+
+        case CLASS_END:
+            if (cursor == limit) {
+                if (at_eof) {
+                    // Like scanner.l, end an unterminated last line with a
+                    // NEWLINE, so its statement is complete.
+                    if (!line_has_text()) {
+                        return 0;
+                    }
+                    finish_line(cursor);
+                    line_start = cursor;
+                    yylineno++;
+                    return NEWLINE;
+                }
+                refill(&cursor);
+                break;
+            }
+            // A '\0' in the input is just another unexpected character.
+            [[fallthrough]];
+
+        default:
+            // Like scanner.l, skip the rest of the line so the parser can
+            // recover at the NEWLINE that ends it.
+            std::cerr << "Unexpected character on line " << yylineno << ": " << (int)c << std::endl;
+            while (tables.char_class[(unsigned char)*cursor] != CLASS_NEWLINE) {
+                if (cursor == limit) {
+                    if (refill(&cursor) == 0) {
+                        break;
+                    }
+                } else {
+                    cursor++;
+                }
+            }
+            return YYUNDEF;
+        }
+    }
+}
+
+#ifdef SCANNER_CHECK
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+
+#undef yylex
+#undef yylineno
+#undef restart_scanner
+#undef finished_line
+int yylex();
+extern int yylineno;
+void restart_scanner(FILE* input);
+const std::string& finished_line();
+
+YYSTYPE yylval;
+
+struct scanned_token {
+    int kind;
+    std::string lexeme;
+    int line;
+};
+
+/*
+ * The lexeme of a NEWLINE is the text of the line it ends, unless lines is
+ * false.
+ */
+static scanned_token next_token(bool direct, bool lines = true) {
+    scanned_token token;
+    token.kind = direct ? direct_yylex() : yylex();
+    token.line = direct ? direct_yylineno : yylineno;
+    if (token.kind == IDENTIFIER || token.kind == INTEGER) {
+        token.lexeme = *yylval.str;
+        delete yylval.str;
+    } else if (token.kind == NEWLINE && lines) {
+        token.lexeme = direct ? direct_finished_line() : finished_line();
+    }
+    return token;
+}
+
+/*
+ * Runs both scanners over text, and reports the first token where they
+ * differ.
+ */
+static bool same_tokens(const std::string& text, const std::string& name) {
+    FILE* flex_input = fmemopen((void*)text.data(), text.size(), "r");
+    FILE* direct_input = fmemopen((void*)text.data(), text.size(), "r");
+    restart_scanner(flex_input);
+    direct_restart_scanner(direct_input);
+
+    // Both scanners complain about unexpected characters; only differences
+    // matter here.
+    std::cerr.setstate(std::ios::failbit);
+    bool same = true;
+    for (size_t n = 0; ; n++) {
+        scanned_token expected = next_token(false);
+        scanned_token actual = next_token(true);
+        if (actual.kind != expected.kind || actual.lexeme != expected.lexeme || actual.line != expected.line) {
+            fprintf(stderr, "%s: token %zu differs: flex returned %d '%s' on line %d, direct returned %d '%s' on line %d\n",
+                name.c_str(), n, expected.kind, expected.lexeme.c_str(), expected.line,
+                actual.kind, actual.lexeme.c_str(), actual.line);
+            same = false;
+            break;
+        }
+        if (expected.kind == 0) {
+            break;
+        }
+    }
+    std::cerr.clear();
+
+    fclose(flex_input);
+    fclose(direct_input);
+    return same;
+}
+
+/*
+ * Random bytes of input, mostly tokens.  Long identifiers and integers are
+ * likely to be split across refills of the scanners' buffers.
+ */
+static std::string random_text(std::mt19937& random, size_t length) {
+    static const char* pieces[] = {
+        "x", "y1", "_tmp", "Abc_9", "while", "if", "None", "Nonez", "iff", "0", "42",
+        " ", "  ", "\t", "\r", "\n", "\n\n", "=", "+", "-", "*", "/", "(", ")", "$", "?", "#"
+    };
+    const size_t num_pieces = sizeof(pieces) / sizeof(pieces[0]);
+    std::string text;
+    while (text.size() < length) {
+        unsigned choice = random() % (num_pieces + 3);
+        if (choice < num_pieces) {
+            text += pieces[choice];
+        } else if (choice == num_pieces) {
+            text += std::string(1 + random() % 100, 'a' + random() % 26);
+        } else if (choice == num_pieces + 1) {
+            text += std::string(1 + random() % 100, '0' + random() % 10);
+        } else {
+            text += '\0';
+        }
+    }
+    text.resize(length);
+    return text;
+}
+
+/*
+ * Like random_text(), but with an identifier or integer that ends right
+ * around the end of the scanners' first 64 KiB block.
+ */
+static std::string boundary_text(std::mt19937& random) {
+    std::string token(1 + random() % 20, random() % 2 ? 'q' : '7');
+    size_t end = (1 << 16) + random() % 5 - 2;
+    std::string text = random_text(random, end - token.size());
+    text.back() = ' ';
+    text += token;
+    text += random() % 2 ? "\n" : " + 1\n";
+    return text + random_text(random, random() % 1000);
+}
+
+static bool read_file(const char* path, std::string& text) {
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    text = contents.str();
+    return !file.fail();
+}
+
+/*
+ * Scans text with each scanner a few times, and reports the fastest run.
+ */
+static void compare_speed(const std::string& text) {
+    for (int direct = 0; direct <= 1; direct++) {
+        double best = 1e30;
+        size_t tokens = 0;
+        for (int run = 0; run < 5; run++) {
+            FILE* input = fmemopen((void*)text.data(), text.size(), "r");
+            direct ? direct_restart_scanner(input) : restart_scanner(input);
+            std::cerr.setstate(std::ios::failbit);
+            auto start = std::chrono::steady_clock::now();
+            tokens = 0;
+            while (next_token(direct, false).kind != 0) {
+                tokens++;
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            std::cerr.clear();
+            fclose(input);
+            best = std::min(best, elapsed.count());
+        }
+        printf("%-6s  %8.1f MB/s  %8.2f M tokens/s\n", direct ? "direct" : "flex",
+            text.size() / best / 1e6, tokens / best / 1e6);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+        std::string text;
+        if (argc > 2 && !read_file(argv[2], text)) {
+            fprintf(stderr, "Error: can't read %s\n", argv[2]);
+            return 1;
+        } else if (argc == 2) {
+            for (int i = 0; text.size() < (64 << 20); i++) {
+                text += "x" + std::to_string(i % 1000) + " = (y1 + 42) * _tmp - " + std::to_string(i) + " / z\n";
+            }
+        }
+        compare_speed(text);
+        return 0;
+    }
+
+    int failed = 0;
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            std::string text;
+            if (!read_file(argv[i], text)) {
+                fprintf(stderr, "Error: can't read %s\n", argv[i]);
+                return 1;
+            }
+            failed += !same_tokens(text, argv[i]);
+        }
+    } else {
+        std::mt19937 random(1);
+        for (int round = 0; round < 2000; round++) {
+            std::string text = round % 4 == 0 ? boundary_text(random) : random_text(random, 1 + random() % (3 << 16));
+            failed += !same_tokens(text, "random input " + std::to_string(round));
+        }
+    }
+    printf("%s\n", failed ? "FAILED" : "ok");
+    return failed ? 1 : 0;
+}
+#endif
@@ -0,0 +1,223 @@
+/*
+ * Tiered execution; see tiered.h.  The compiled tier uses MCJIT, with one
+ * execution engine (and LLVM context) per program, so compiles on different
+ * threads never share any LLVM state.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <llvm-c/ExecutionEngine.h>
+#include <llvm-c/Target.h>
+#include <llvm-c/Transforms/PassBuilder.h>
+#include "bytecode.h"
+#include "tiered.h"
+
+typedef int32_t (*program_function)(int32_t* vars);
+
+struct tiered_program {
+    ast tree;
+    bytecode code;
+    uint32_t threshold;
+    std::atomic<uint32_t> runs;
+    std::atomic<program_function> compiled;
+
+    std::thread compiler;
+    LLVMContextRef context;
+    LLVMExecutionEngineRef engine;
+};
+
+static void initialize_jit() {
+    static std::once_flag initialized;
+    std::call_once(initialized, []() {
+        LLVMLinkInMCJIT();
+        LLVMInitializeNativeTarget();
+        LLVMInitializeNativeAsmPrinter();
+    });
+}
+
+/*
+ * Builds tree's module in context, optimizes it and hands it to a new MCJIT
+ * engine.  Returns the compiled program, or NULL (with *engine set to NULL)
+ * if anything goes wrong.
+ */
+static program_function jit_compile(const ast& tree, LLVMContextRef context, LLVMExecutionEngineRef* engine) {
+    LLVMModuleRef module = build_llvm_module(tree, context);
+
+    // MCJIT only runs the code generator, which gets very slow on a large
+    // function full of allocas, so the IR is optimized first.
+    LLVMPassBuilderOptionsRef pass_options = LLVMCreatePassBuilderOptions();
+    LLVMErrorRef pass_error = LLVMRunPasses(module, "default<O2>", NULL, pass_options);
+    LLVMDisposePassBuilderOptions(pass_options);
+    if (pass_error) {
+        LLVMConsumeError(pass_error);
+    }
+
+    // The code generator itself runs at its lowest level.  A program is one
+    // long block, which its instruction scheduler takes quadratic time on
+    // (minutes for the large program in parser.y's compare_tiers()), and
+    // the passes above have already done the optimizing that matters.
+    LLVMMCJITCompilerOptions options;
+    LLVMInitializeMCJITCompilerOptions(&options, sizeof(options));
+    options.OptLevel = 0;
+    char* error = NULL;
+    // The module belongs to the engine from here on, even if creating the
+    // engine fails, in which case it has already been freed.
+    if (LLVMCreateMCJITCompilerForModule(engine, module, &options, sizeof(options), &error)) {
+        LLVMDisposeMessage(error);
+        *engine = NULL;
+        return NULL;
+    }
+    return (program_function)LLVMGetFunctionAddress(*engine, "program");
+}
+
+/*
+ * Runs on the background thread.  If anything goes wrong, the program simply
+ * stays in the interpreter.
+ */
+static void compile_program(tiered_program* program) {
+    program->context = LLVMContextCreate();
+    program_function function = jit_compile(program->tree, program->context, &program->engine);
+    if (function) {
+        program->compiled.store(function, std::memory_order_release);
+    }
+}
+
+tiered_program* tiered_create(const ast& tree, uint32_t threshold) {
+    initialize_jit();
+    tiered_program* program = new tiered_program;
+    program->tree = tree;
+    program->code = compile_bytecode(program->tree);
+    program->threshold = threshold;
+    program->runs = 0;
+    program->compiled = NULL;
+    program->context = NULL;
+    program->engine = NULL;
+    return program;
+}
+
+bool tiered_run(tiered_program* program, int32_t* vars) {
+    program_function compiled = program->compiled.load(std::memory_order_acquire);
+    if (compiled) {
+        return compiled(vars) == 0;
+    }
+
+    // Each thread has its own registers, so concurrent runs don't clash.
+    static thread_local std::vector<int32_t> registers;
+    registers.resize(program->code.num_registers);
+    std::copy(vars, vars + program->code.num_symbols, registers.begin());
+    if (!run_bytecode(program->code, registers.data())) {
+        return false;
+    }
+    std::copy(registers.begin(), registers.begin() + program->code.num_symbols, vars);
+
+    // Only successful runs count towards the threshold.
+    uint32_t runs = program->runs.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (runs == program->threshold) {
+        program->compiler = std::thread(compile_program, program);
+    }
+    return true;
+}
+
+bool tiered_is_compiled(const tiered_program* program) {
+    return program->compiled.load(std::memory_order_acquire) != NULL;
+}
+
+void tiered_destroy(tiered_program* program) {
+    if (program->compiler.joinable()) {
+        program->compiler.join();
+    }
+    if (program->engine) {
+        LLVMDisposeExecutionEngine(program->engine);
+    }
+    if (program->context) {
+        LLVMContextDispose(program->context);
+    }
+    delete program;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+/*
+ * Calls run more and more often, until that takes long enough to measure,
+ * and returns the time for one call.
+ */
+template <typename Run>
+static double seconds_per_run(Run run) {
+    for (long runs = 1; ; runs *= 2) {
+        auto start = std::chrono::steady_clock::now();
+        for (long i = 0; i < runs; i++) {
+            run();
+        }
+        double elapsed = seconds_since(start);
+        if (elapsed >= 0.1) {
+            return elapsed / runs;
+        }
+    }
+}
+
+bool tiered_compare(const char* name, const ast& tree, const std::vector<int32_t>& inputs) {
+    initialize_jit();
+
+    // Every run starts from the inputs again, and both tiers' results are
+    // taken from their first run.  The interpreter's first run includes
+    // compiling the bytecode.
+    auto start = std::chrono::steady_clock::now();
+    bytecode code = compile_bytecode(tree);
+    std::vector<int32_t> registers(code.num_registers);
+    std::copy(inputs.begin(), inputs.end(), registers.begin());
+    bool ok = run_bytecode(code, registers.data());
+    double interpreter_start = seconds_since(start);
+    if (!ok) {
+        fprintf(stderr, "Error: division by zero\n");
+        return false;
+    }
+    std::vector<int32_t> interpreted(registers.begin(), registers.begin() + tree.num_symbols());
+    double interpreter_run = seconds_per_run([&] {
+        std::copy(inputs.begin(), inputs.end(), registers.begin());
+        run_bytecode(code, registers.data());
+    });
+
+    // The compiled code's includes building, optimizing and compiling the
+    // module, like the background compile in tiered_run().
+    std::vector<int32_t> vars(inputs);
+    start = std::chrono::steady_clock::now();
+    LLVMContextRef context = LLVMContextCreate();
+    LLVMExecutionEngineRef engine = NULL;
+    program_function function = jit_compile(tree, context, &engine);
+    if (function) {
+        ok = function(vars.data()) == 0;
+    }
+    double compiled_start = seconds_since(start);
+    std::vector<int32_t> compiled(vars);
+    double compiled_run = !function ? 0 : seconds_per_run([&] {
+        std::copy(inputs.begin(), inputs.end(), vars.begin());
+        function(vars.data());
+    });
+
+    printf("%-6s  %-8s  first run %10.1f us  later runs %10.3f us\n", name, "bytecode",
+        interpreter_start * 1e6, interpreter_run * 1e6);
+    if (function) {
+        printf("%-6s  %-8s  first run %10.1f us  later runs %10.3f us\n", name, "llvm",
+            compiled_start * 1e6, compiled_run * 1e6);
+    } else {
+        fprintf(stderr, "Error: can't compile the program with LLVM\n");
+    }
+
+    bool same = function && ok && compiled == interpreted;
+    if (function && !same) {
+        fprintf(stderr, "Error: the interpreter and the compiled code disagree\n");
+    }
+    if (engine) {
+        LLVMDisposeExecutionEngine(engine);
+    }
+    LLVMContextDispose(context);
+    return same;
+}
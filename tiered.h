@@ -0,0 +1,60 @@
+/*
+ * Tiered execution of parsed programs.
+ *
+ * Most programs run only once, and for those the bytecode interpreter (see
+ * bytecode.h) is the fastest way to run them, because it doesn't have to wait
+ * for LLVM.  A program that runs many times is better off compiled.  So every
+ * program starts out interpreted, and counts its runs.  When the count
+ * reaches a threshold, the program is compiled with the LLVM back end (see
+ * ast-llvm.c) on a background thread, and later runs call the compiled code.
+ *
+ * The compiled function is published with an atomic store once it's ready.
+ * Runs that are already in the interpreter when that happens just finish
+ * there, since the bytecode stays around until the program is destroyed.
+ */
+
+#ifndef TIERED_H
+#define TIERED_H
+
+#include <cstdint>
+#include <vector>
+#include "ast.h"
+
+struct tiered_program;
+
+/*
+ * Prepares tree to be run.  The tree is copied, so it can be reused for
+ * another program afterwards.  A program is compiled once it has been run
+ * threshold times, or never if threshold is 0.
+ */
+tiered_program* tiered_create(const ast& tree, uint32_t threshold);
+
+/*
+ * Runs the program on the variables in vars[symbol ID], which hold the
+ * values that variables read before they're assigned, and stores the final
+ * value of each variable back into vars.  It's safe to run the same program on several threads at
+ * once.  Returns false if the program divides by zero.
+ */
+bool tiered_run(tiered_program* program, int32_t* vars);
+
+/*
+ * Returns true once calls go to the compiled code.
+ */
+bool tiered_is_compiled(const tiered_program* program);
+
+/*
+ * Waits for a compile that's still in progress, and frees everything.
+ */
+void tiered_destroy(tiered_program* program);
+
+/*
+ * Benchmarks the two tiers on tree, printing one line for each: how long it
+ * takes from the parsed program to the end of the first run, and how long
+ * each run takes after that.  Every run starts with the variables set to
+ * inputs, which has one value per symbol; since they are only known at run
+ * time, LLVM can't compute the results ahead.  Returns false if the tiers
+ * don't compute the same values, or if the program can't be run.
+ */
+bool tiered_compare(const char* name, const ast& tree, const std::vector<int32_t>& inputs);
+
+#endif
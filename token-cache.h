@@ -0,0 +1,62 @@
+/*
+ * Binary token cache.
+ *
+ * Scanning is the same work every time we parse the same input, so we can do
+ * it once, save the token stream, and have later runs replay it instead:
+ *
+ *   token-record.c wraps the flex scanner.  Every token it returns is also
+ *   appended to the cache file, which is written out at the end of the input.
+ *
+ *   token-replay.c provides a yylex() that maps the cache file into memory and
+ *   hands its tokens to parser.y (or pushes them into parser-push.y).
+ *
+ * The cache file is given by the TOKEN_CACHE environment variable, or
+ * "tokens.cache" if it isn't set.  Its layout, in the byte order of the
+ * machine that wrote it:
+ *
+ *   struct token_cache_header      header
+ *   struct token_record            tokens[num_tokens]
+ *   uint32_t                       lexeme_offsets[num_lexemes + 1]
+ *   char                           lexeme_bytes[lexeme_bytes]
+ *
+ * Lexemes are interned, so each distinct identifier or integer is stored
+ * once.  Lexeme i is the bytes from lexeme_offsets[i] to lexeme_offsets[i+1].
+ * Counts and offsets are 32 bits, so token-record.c gives up on an input
+ * with more tokens or lexeme bytes than that, and writes no cache for it.
+ *
+ * Token kinds are stored as the parser's token numbers.  parser.y and
+ * parser-push.y number their shared tokens the same way, so a cache can be
+ * replayed into either parser.
+ */
+
+#ifndef TOKEN_CACHE_H
+#define TOKEN_CACHE_H
+
+#include <cstdint>
+#include <cstdlib>
+
+#define TOKEN_CACHE_MAGIC "TOKCACHE"
+#define TOKEN_CACHE_VERSION 1
+#define NO_LEXEME UINT32_MAX
+
+struct token_cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_tokens;
+    uint32_t num_lexemes;
+    uint32_t lexeme_bytes;
+};
+
+struct token_record {
+    uint32_t line;     // yylineno after the token was scanned
+    uint32_t lexeme;   // Index of the lexeme, or NO_LEXEME
+    uint16_t kind;     // Token kind, 0 only for the final end of input
+    uint16_t unused;
+};
+
+inline const char* token_cache_path() {
+    const char* path = getenv("TOKEN_CACHE");
+    return path ? path : "tokens.cache";
+}
+
+#endif
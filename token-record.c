@@ -0,0 +1,130 @@
+/*
+ * Records the token stream of the flex scanner into the token cache (see
+ * token-cache.h) while parsing as usual.  The scanner's own yylex() is
+ * renamed to scan_token(), and this file's yylex() wraps it:
+ *
+ *   flex -o scanner.c scanner.l
+ *   g++ -DYY_DECL="int scan_token()" parser.c scanner.c ast.c bytecode.c parser-pratt.c token-record.c -o parser-record
+ *   ./parser-record < source.py
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "parser.h"
+#include "token-cache.h"
+
+int scan_token();
+extern int yylineno;
+
+static FILE* cache_file = NULL;
+static token_cache_header header;
+static std::unordered_map<std::string, uint32_t> lexeme_ids;
+static std::vector<uint32_t> lexeme_offsets(1, 0);
+static std::string lexeme_bytes;
+
+/*
+ * Gives up on the cache, for an input too big for its 32-bit counts and
+ * offsets, or when it can't be written.  A partial cache would be worse than
+ * none, so the file is removed.  The parse itself carries on.
+ */
+static void abandon_cache(const char* reason) {
+    fprintf(stderr, "%s: %s, removing the token cache\n", token_cache_path(), reason);
+    fclose(cache_file);
+    remove(token_cache_path());
+    cache_file = NULL;
+}
+
+/*
+ * Returns the lexeme's index, or NO_LEXEME if the lexeme table is full.
+ */
+static uint32_t intern(const std::string& lexeme) {
+    auto found = lexeme_ids.find(lexeme);
+    if (found != lexeme_ids.end()) {
+        return found->second;
+    }
+    if (lexeme_ids.size() == NO_LEXEME - 1 || lexeme.size() > UINT32_MAX - lexeme_bytes.size()) {
+        return NO_LEXEME;
+    }
+    uint32_t id = lexeme_ids.size();
+    lexeme_ids.emplace(lexeme, id);
+    lexeme_bytes += lexeme;
+    lexeme_offsets.push_back(lexeme_bytes.size());
+    return id;
+}
+
+/*
+ * Token records are streamed out as they come in.  The lexeme table and the
+ * final counts are only known at the end, so the table goes after the tokens
+ * and the header is written again once everything else is in place.
+ */
+static void open_cache() {
+    cache_file = fopen(token_cache_path(), "wb");
+    if (!cache_file) {
+        perror(token_cache_path());
+        exit(1);
+    }
+    memcpy(header.magic, TOKEN_CACHE_MAGIC, sizeof(header.magic));
+    header.version = TOKEN_CACHE_VERSION;
+    fwrite(&header, sizeof(header), 1, cache_file);
+}
+
+static void close_cache() {
+    if (!cache_file) {
+        return;
+    }
+    header.num_lexemes = lexeme_ids.size();
+    header.lexeme_bytes = lexeme_bytes.size();
+    fwrite(lexeme_offsets.data(), sizeof(uint32_t), lexeme_offsets.size(), cache_file);
+    fwrite(lexeme_bytes.data(), 1, lexeme_bytes.size(), cache_file);
+    fseek(cache_file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, cache_file);
+    if (ferror(cache_file)) {
+        abandon_cache("write error");
+        return;
+    }
+    if (fclose(cache_file) != 0) {
+        perror(token_cache_path());
+        remove(token_cache_path());
+    }
+    cache_file = NULL;
+}
+
+int yylex() {
+    if (!cache_file && header.num_tokens == 0) {
+        // The parser may stop without asking for the end of the input, so
+        // the cache is finished at exit as well.
+        open_cache();
+        atexit(close_cache);
+    }
+
+    int kind = scan_token();
+    if (!cache_file) {
+        return kind;
+    }
+
+    if (header.num_tokens == UINT32_MAX) {
+        abandon_cache("too many tokens");
+        return kind;
+    }
+    token_record record = {};
+    record.line = yylineno;
+    record.kind = kind;
+    record.lexeme = NO_LEXEME;
+    if (kind == IDENTIFIER || kind == INTEGER) {
+        record.lexeme = intern(*yylval.str);
+        if (record.lexeme == NO_LEXEME) {
+            abandon_cache("too many distinct lexemes");
+            return kind;
+        }
+    }
+    fwrite(&record, sizeof(record), 1, cache_file);
+    header.num_tokens++;
+
+    if (kind == 0) {
+        close_cache();
+    }
+    return kind;
+}
@@ -0,0 +1,239 @@
+/*
+ * Replays a token cache written by token-record.c (see token-cache.h), so
+ * the parsers can run without scanning their input again.  For parser.y this
+ * is a drop-in replacement for the scanner:
+ *
+ *   g++ parser.c ast.c bytecode.c parser-pratt.c token-replay.c -o parser-replay
+ *
+ * For the push parser, define PUSH_PARSER; yylex() then pushes the whole
+ * token stream into parser-push.y, like scanner-push.l does:
+ *
+ *   g++ -DPUSH_PARSER parser-push.c token-replay.c -o parser-push-replay
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef PUSH_PARSER
+#include "parser-push.h"
+#else
+#include "parser.h"
+#include "keywords.h"
+#endif
+#include "token-cache.h"
+
+int yylineno = 1;
+
+struct token_cache {
+    const token_cache_header* header;
+    const token_record* tokens;
+    const uint32_t* lexeme_offsets;
+    const char* lexeme_bytes;
+    size_t size;
+};
+
+/*
+ * Maps the cache file into memory and checks that its sizes add up before
+ * anything is read from it.
+ */
+static bool map_cache(token_cache* cache) {
+    const char* path = token_cache_path();
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror(path);
+        close(fd);
+        return false;
+    }
+
+    cache->size = st.st_size;
+    void* data = cache->size ? mmap(NULL, cache->size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (data == MAP_FAILED || cache->size < sizeof(token_cache_header)) {
+        fprintf(stderr, "%s: not a token cache\n", path);
+        return false;
+    }
+
+    const char* bytes = (const char*)data;
+    cache->header = (const token_cache_header*)bytes;
+    size_t tokens_size = (size_t)cache->header->num_tokens * sizeof(token_record);
+    size_t offsets_size = ((size_t)cache->header->num_lexemes + 1) * sizeof(uint32_t);
+    size_t expected = sizeof(token_cache_header) + tokens_size + offsets_size + cache->header->lexeme_bytes;
+    if (memcmp(cache->header->magic, TOKEN_CACHE_MAGIC, sizeof(cache->header->magic)) != 0
+        || cache->header->version != TOKEN_CACHE_VERSION
+        || cache->size != expected) {
+        fprintf(stderr, "%s: not a token cache, or written by a different version\n", path);
+        munmap(data, cache->size);
+        return false;
+    }
+
+    cache->tokens = (const token_record*)(bytes + sizeof(token_cache_header));
+    cache->lexeme_offsets = (const uint32_t*)(bytes + sizeof(token_cache_header) + tokens_size);
+    cache->lexeme_bytes = bytes + sizeof(token_cache_header) + tokens_size + offsets_size;
+
+    // Lexemes are read without further checks, so they have to be in bounds.
+    const uint32_t* offsets = cache->lexeme_offsets;
+    bool in_bounds = offsets[0] == 0 && offsets[cache->header->num_lexemes] == cache->header->lexeme_bytes;
+    for (uint32_t i = 0; in_bounds && i < cache->header->num_lexemes; i++) {
+        in_bounds = offsets[i] <= offsets[i + 1];
+    }
+    if (!in_bounds) {
+        fprintf(stderr, "%s: lexeme offsets out of bounds\n", path);
+        munmap(data, cache->size);
+        return false;
+    }
+    return true;
+}
+
+static std::string* lexeme(const token_cache& cache, const token_record& record) {
+    if (record.lexeme == NO_LEXEME || record.lexeme >= cache.header->num_lexemes) {
+        return NULL;
+    }
+    uint32_t start = cache.lexeme_offsets[record.lexeme];
+    uint32_t end = cache.lexeme_offsets[record.lexeme + 1];
+    return new std::string(cache.lexeme_bytes + start, end - start);
+}
+
+/*
+ * The cache doesn't keep the text of the input, so the text of a line is put
+ * back together from its tokens, one space apart.  Unexpected characters
+ * aren't in the cache either, so they show up as '?'.
+ */
+static void append_spelling(std::string& text, const token_cache& cache, const token_record& record) {
+    if (record.lexeme != NO_LEXEME && record.lexeme < cache.header->num_lexemes) {
+        uint32_t start = cache.lexeme_offsets[record.lexeme];
+        text.append(cache.lexeme_bytes + start, cache.lexeme_offsets[record.lexeme + 1] - start);
+        return;
+    }
+    switch (record.kind) {
+    case LPAREN: text += '('; return;
+    case RPAREN: text += ')'; return;
+    case PLUS: text += '+'; return;
+    case MINUS: text += '-'; return;
+    case TIMES: text += '*'; return;
+    case DIVIDEDBY: text += '/'; return;
+    case ASSIGN: text += '='; return;
+    }
+#ifndef PUSH_PARSER
+    for (const keyword& k : keywords) {
+        if (k.token == record.kind) {
+            text += k.name;
+            return;
+        }
+    }
+#endif
+    text += '?';
+}
+
+static std::string line_text(const token_cache& cache, uint32_t first, uint32_t end) {
+    std::string text;
+    for (uint32_t i = first; i < end; i++) {
+        const token_record& record = cache.tokens[i];
+        if (record.kind == INDENT || record.kind == DEDENT) {
+            continue;
+        }
+        if (!text.empty()) {
+            text += ' ';
+        }
+        append_spelling(text, cache, record);
+    }
+    return text;
+}
+
+#ifndef PUSH_PARSER
+
+static token_cache cache;
+static uint32_t next = 0;
+
+/*
+ * The tokens of the line being replayed start at line_first, and the last
+ * finished line's are [finished_first, finished_end).  Its text is only put
+ * together when finished_line() asks for it.
+ */
+static uint32_t line_first = 0;
+static uint32_t finished_first = 0;
+static uint32_t finished_end = 0;
+
+const std::string& finished_line() {
+    static std::string text;
+    text = line_text(cache, finished_first, finished_end);
+    return text;
+}
+
+/*
+ * parser.y only restarts the scanner for -b and --check, which parse text of
+ * their own.  A token cache has no text to scan, so they can't run here.
+ */
+void restart_scanner(FILE*) {
+    fprintf(stderr, "Error: -b and --check need the scanner, not a token cache\n");
+    exit(1);
+}
+
+int yylex() {
+    static bool mapped = false;
+
+    if (!mapped) {
+        if (!map_cache(&cache)) {
+            return 0;
+        }
+        mapped = true;
+    }
+    if (next == cache.header->num_tokens) {
+        return 0;
+    }
+
+    const token_record& record = cache.tokens[next++];
+    yylineno = record.line;
+    if (record.lexeme != NO_LEXEME) {
+        yylval.str = lexeme(cache, record);
+    }
+    if (record.kind == NEWLINE) {
+        finished_first = line_first;
+        finished_end = next - 1;
+        line_first = next;
+    }
+    return record.kind;
+}
+
+#else
+
+int yylex() {
+    token_cache cache;
+    if (!map_cache(&cache)) {
+        return 1;
+    }
+
+    yypstate* pstate = yypstate_new();
+    YYSTYPE yylval;
+    YYLTYPE loc;
+    int status = YYPUSH_MORE;
+    uint32_t line_first = 0;
+    for (uint32_t i = 0; i < cache.header->num_tokens && status == YYPUSH_MORE; i++) {
+        const token_record& record = cache.tokens[i];
+        yylineno = record.line;
+        // A NEWLINE carries the text of its line, like in scanner-push.l.
+        if (record.kind == NEWLINE) {
+            yylval = new std::string(line_text(cache, line_first, i));
+            line_first = i + 1;
+        } else {
+            yylval = lexeme(cache, record);
+        }
+        loc.first_line = loc.last_line = record.line;
+        status = yypush_parse(pstate, record.kind, &yylval, &loc);
+    }
+    if (status == YYPUSH_MORE) {
+        status = yypush_parse(pstate, 0, NULL, NULL);
+    }
+    yypstate_delete(pstate);
+    return status;
+}
+
+#endif
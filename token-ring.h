@@ -0,0 +1,142 @@
+/*
+ * Single-producer, single-consumer ring buffer of tokens.
+ *
+ * When scanner-push.l is built with -DPIPELINE, the scanner and the parser
+ * run on separate threads and pass tokens through one of these, so scanning
+ * the next part of a large input overlaps with parsing the part before it:
+ *
+ *   bison -d -o parser-push.c parser-push.y
+ *   flex -o scanner-push.c scanner-push.l
+ *   g++ -DPIPELINE parser-push.c scanner-push.c -lpthread -o parser-push-pipeline
+ *
+ * The scanner thread is the only one that moves tail, and the parser thread
+ * is the only one that moves head, so neither needs a lock.  Each side keeps
+ * its own position and only publishes it every TOKEN_RING_BATCH tokens (or
+ * when it has to wait), so the two threads touch each other's cache lines
+ * once per batch instead of once per token.
+ *
+ * When the ring is full, the scanner waits for the parser to catch up, so a
+ * fast scanner can't run arbitrarily far ahead of the parser.  If the parser
+ * gives up early, the scanner notices within a batch and stops too, and the
+ * values of the tokens the parser never took are freed by token_ring_reset().
+ */
+
+#ifndef TOKEN_RING_H
+#define TOKEN_RING_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#define TOKEN_RING_SIZE 4096    // Must be a power of 2
+#define TOKEN_RING_BATCH 64
+
+struct ring_token {
+    int kind;              // 0 for the end of the input
+    std::string* value;    // Lexeme, or line text for NEWLINE, or NULL
+    int line;
+};
+
+struct token_ring {
+    ring_token tokens[TOKEN_RING_SIZE];
+
+    // Shared.  head is the next token the parser will take, tail is one past
+    // the last token the scanner has handed over, and closed is set when the
+    // parser stops taking tokens.
+    alignas(64) std::atomic<uint32_t> head{0};
+    alignas(64) std::atomic<uint32_t> tail{0};
+    std::atomic<bool> closed{false};
+
+    // Only used by the scanner thread.
+    alignas(64) uint32_t write = 0;
+    uint32_t known_head = 0;
+
+    // Only used by the parser thread.
+    alignas(64) uint32_t read = 0;
+    uint32_t known_tail = 0;
+};
+
+/*
+ * Hands over every token written so far.  The scanner must flush after the
+ * last token.
+ */
+inline void token_ring_flush(token_ring* ring) {
+    ring->tail.store(ring->write, std::memory_order_release);
+}
+
+/*
+ * Adds a token, waiting while the ring is full.  Returns false (without
+ * adding it) if the parser has stopped, which is checked at the start of
+ * every batch and while waiting.
+ */
+inline bool token_ring_put(token_ring* ring, const ring_token& token) {
+    if (ring->write % TOKEN_RING_BATCH == 0 &&
+            ring->closed.load(std::memory_order_acquire)) {
+        return false;
+    }
+    if (ring->write - ring->known_head == TOKEN_RING_SIZE) {
+        ring->known_head = ring->head.load(std::memory_order_acquire);
+        while (ring->write - ring->known_head == TOKEN_RING_SIZE) {
+            if (ring->closed.load(std::memory_order_acquire)) {
+                return false;
+            }
+            token_ring_flush(ring);
+            std::this_thread::yield();
+            ring->known_head = ring->head.load(std::memory_order_acquire);
+        }
+    }
+
+    ring->tokens[ring->write % TOKEN_RING_SIZE] = token;
+    ring->write++;
+    if (ring->write % TOKEN_RING_BATCH == 0) {
+        token_ring_flush(ring);
+    }
+    return true;
+}
+
+/*
+ * Takes the next token, waiting until the scanner has handed one over.
+ */
+inline ring_token token_ring_get(token_ring* ring) {
+    if (ring->read == ring->known_tail) {
+        // Give back the space of the tokens taken so far before waiting.
+        ring->head.store(ring->read, std::memory_order_release);
+        ring->known_tail = ring->tail.load(std::memory_order_acquire);
+        while (ring->read == ring->known_tail) {
+            std::this_thread::yield();
+            ring->known_tail = ring->tail.load(std::memory_order_acquire);
+        }
+    }
+
+    ring_token token = ring->tokens[ring->read % TOKEN_RING_SIZE];
+    ring->read++;
+    if (ring->read % TOKEN_RING_BATCH == 0) {
+        ring->head.store(ring->read, std::memory_order_release);
+    }
+    return token;
+}
+
+/*
+ * Tells the scanner that the parser won't take any more tokens.
+ */
+inline void token_ring_close(token_ring* ring) {
+    ring->closed.store(true, std::memory_order_release);
+}
+
+/*
+ * Frees the values of the tokens the parser didn't take and empties the ring
+ * for the next scan.  Only call this once the parser thread has finished.
+ */
+inline void token_ring_reset(token_ring* ring) {
+    for (uint32_t i = ring->read; i != ring->write; i++) {
+        delete ring->tokens[i % TOKEN_RING_SIZE].value;
+    }
+    ring->head.store(0, std::memory_order_relaxed);
+    ring->tail.store(0, std::memory_order_relaxed);
+    ring->closed.store(false, std::memory_order_relaxed);
+    ring->write = ring->known_head = 0;
+    ring->read = ring->known_tail = 0;
+}
+
+#endif